@@ -0,0 +1,548 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#elif defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(__NR_io_uring_register)
+#define ASD_HAS_IO_URING 1
+#endif
+#endif
+
+#include "Byte_Counter.hpp"
+#include "File_Reader.hpp"
+#include "Phase_Profiler.hpp"
+#include "Stats_Counter.hpp"
+
+// How file contents are read for counting.
+enum class ioEngine
+{
+    // One blocking read (or mapping) at a time per analysis thread.
+    sync,
+    // Many reads in flight per analysis thread: io_uring on Linux,
+    // overlapped reads on an I/O completion port on Windows.
+    async
+};
+
+// Counts of one file read by asyncReader.
+struct countedResult {
+    counter stats;
+    bool opened = false;
+};
+
+// Platform queue of reads into a fixed set of buffers ("slots"). Reads are
+// queued with read() and sent to the system by wait(), which returns once
+// at least one of them completed.
+class ioQueue
+{
+public:
+
+    struct completion {
+        int slot;
+        std::int64_t result;
+    };
+
+#ifdef _WIN32
+    using fileHandle = HANDLE;
+    inline static const fileHandle noFile = INVALID_HANDLE_VALUE;
+#else
+    using fileHandle = int;
+    inline static const fileHandle noFile = -1;
+#endif
+
+    ioQueue(int _slots, std::size_t _slot_size);
+
+    ~ioQueue();
+
+    ioQueue(const ioQueue&) = delete;
+    ioQueue& operator=(const ioQueue&) = delete;
+
+    // False when the system offers no asynchronous reads.
+    bool ready() const;
+
+    // Why the queue isn't ready.
+    std::string failure() const;
+
+    char* buffer(int slot) const;
+
+    fileHandle open_file(const char* path, std::uint64_t& size);
+
+    void close_file(fileHandle file);
+
+    void read(int slot, fileHandle file, std::uint64_t offset, std::uint32_t length);
+
+    void wait(std::vector<completion>& completions);
+
+private:
+
+    int slots;
+    std::size_t slot_size;
+    std::unique_ptr<char[]> memory;
+    bool is_ready = false;
+    int setup_error = 0;
+
+#ifdef _WIN32
+    HANDLE port = nullptr;
+    std::unique_ptr<OVERLAPPED[]> overlapped;
+    std::vector<completion> failed;
+#elif defined(ASD_HAS_IO_URING)
+    int ring_fd = -1;
+    void* sq_ring = MAP_FAILED;
+    void* cq_ring = MAP_FAILED;
+    std::size_t sq_ring_size = 0;
+    std::size_t cq_ring_size = 0;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    std::size_t sqes_size = 0;
+    unsigned* sq_tail = nullptr;
+    unsigned sq_mask = 0;
+    unsigned* sq_array = nullptr;
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned cq_mask = 0;
+    io_uring_cqe* cqes = nullptr;
+    unsigned to_submit = 0;
+    bool fixed_buffers = false;
+#endif
+};
+
+ioQueue::ioQueue(int _slots, std::size_t _slot_size)
+    : slots(_slots), slot_size(_slot_size), memory(new char[static_cast<std::size_t>(_slots) * _slot_size])
+{
+#ifdef _WIN32
+    port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1);
+    overlapped.reset(new OVERLAPPED[slots]);
+    is_ready = port != nullptr;
+    if (!is_ready)
+        setup_error = static_cast<int>(GetLastError());
+#elif defined(ASD_HAS_IO_URING)
+    io_uring_params params = {};
+    ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, static_cast<unsigned>(slots), &params));
+    if (ring_fd < 0)
+    {
+        setup_error = errno;
+        return;
+    }
+
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+    sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ring == MAP_FAILED)
+    {
+        setup_error = errno;
+        return;
+    }
+    cq_ring = params.features & IORING_FEAT_SINGLE_MMAP ? sq_ring
+        : mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = static_cast<io_uring_sqe*>(mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES));
+    if (cq_ring == MAP_FAILED || sqes == MAP_FAILED)
+    {
+        setup_error = errno;
+        return;
+    }
+
+    char* sq = static_cast<char*>(sq_ring);
+    char* cq = static_cast<char*>(cq_ring);
+    sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    // Registered buffers save the kernel mapping them on every read; when
+    // the memlock limit doesn't allow it, plain reads into them still work.
+    std::vector<iovec> buffers(slots);
+    for (int i = 0; i < slots; i++)
+        buffers[i] = iovec{ buffer(i), slot_size };
+    fixed_buffers = syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_BUFFERS, buffers.data(), static_cast<unsigned>(slots)) == 0;
+    is_ready = true;
+#endif
+}
+
+ioQueue::~ioQueue()
+{
+#ifdef _WIN32
+    if (port != nullptr)
+        CloseHandle(port);
+#elif defined(ASD_HAS_IO_URING)
+    if (sqes != MAP_FAILED)
+        munmap(sqes, sqes_size);
+    if (cq_ring != MAP_FAILED && cq_ring != sq_ring)
+        munmap(cq_ring, cq_ring_size);
+    if (sq_ring != MAP_FAILED)
+        munmap(sq_ring, sq_ring_size);
+    if (ring_fd >= 0)
+        close(ring_fd);
+#endif
+}
+
+bool ioQueue::ready() const
+{
+    return is_ready;
+}
+
+std::string ioQueue::failure() const
+{
+    if (is_ready)
+        return "";
+    if (setup_error == 0)
+        return "not supported on this system";
+    return std::system_category().message(setup_error);
+}
+
+char* ioQueue::buffer(int slot) const
+{
+    return memory.get() + static_cast<std::size_t>(slot) * slot_size;
+}
+
+#ifdef _WIN32
+ioQueue::fileHandle ioQueue::open_file(const char* path, std::uint64_t& size)
+{
+    HANDLE file = CreateFileW(std::filesystem::path(path).c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+        nullptr, OPEN_EXISTING, FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return noFile;
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || CreateIoCompletionPort(file, port, 0, 0) == nullptr)
+    {
+        CloseHandle(file);
+        return noFile;
+    }
+    size = static_cast<std::uint64_t>(fileSize.QuadPart);
+    return file;
+}
+
+void ioQueue::close_file(fileHandle file)
+{
+    CloseHandle(file);
+}
+
+void ioQueue::read(int slot, fileHandle file, std::uint64_t offset, std::uint32_t length)
+{
+    OVERLAPPED& request = overlapped[slot];
+    request = {};
+    request.Offset = static_cast<DWORD>(offset);
+    request.OffsetHigh = static_cast<DWORD>(offset >> 32);
+    if (!ReadFile(file, buffer(slot), length, nullptr, &request) && GetLastError() != ERROR_IO_PENDING)
+        failed.push_back(completion{ slot, GetLastError() == ERROR_HANDLE_EOF ? 0 : -1 });
+}
+
+void ioQueue::wait(std::vector<completion>& completions)
+{
+    completions.swap(failed);
+    failed.clear();
+    if (!completions.empty())
+        return;
+    OVERLAPPED_ENTRY entries[64];
+    ULONG got = 0;
+    if (!GetQueuedCompletionStatusEx(port, entries, 64, &got, INFINITE, FALSE))
+        return;
+    for (ULONG i = 0; i < got; i++)
+    {
+        const int slot = static_cast<int>(entries[i].lpOverlapped - overlapped.get());
+        const bool succeeded = static_cast<LONG>(entries[i].Internal) >= 0;
+        completions.push_back(completion{ slot, succeeded ? static_cast<std::int64_t>(entries[i].dwNumberOfBytesTransferred) : -1 });
+    }
+}
+#elif defined(ASD_HAS_IO_URING)
+ioQueue::fileHandle ioQueue::open_file(const char* path, std::uint64_t& size)
+{
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return noFile;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode))
+    {
+        close(fd);
+        return noFile;
+    }
+    size = static_cast<std::uint64_t>(info.st_size);
+    return fd;
+}
+
+void ioQueue::close_file(fileHandle file)
+{
+    close(file);
+}
+
+void ioQueue::read(int slot, fileHandle file, std::uint64_t offset, std::uint32_t length)
+{
+    const unsigned tail = *sq_tail;
+    const unsigned index = tail & sq_mask;
+    io_uring_sqe& entry = sqes[index];
+    std::memset(&entry, 0, sizeof(entry));
+    entry.opcode = fixed_buffers ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    entry.fd = file;
+    entry.addr = reinterpret_cast<std::uint64_t>(buffer(slot));
+    entry.len = length;
+    entry.off = offset;
+    entry.buf_index = static_cast<std::uint16_t>(slot);
+    entry.user_data = static_cast<std::uint64_t>(slot);
+    sq_array[index] = index;
+    std::atomic_ref<unsigned>(*sq_tail).store(tail + 1, std::memory_order_release);
+    to_submit++;
+}
+
+void ioQueue::wait(std::vector<completion>& completions)
+{
+    completions.clear();
+    unsigned head = std::atomic_ref<unsigned>(*cq_head).load(std::memory_order_relaxed);
+    if (head == std::atomic_ref<unsigned>(*cq_tail).load(std::memory_order_acquire) || to_submit > 0)
+    {
+        long submitted;
+        do
+        {
+            submitted = syscall(__NR_io_uring_enter, ring_fd, to_submit, 1u, IORING_ENTER_GETEVENTS, nullptr, 0);
+        } while (submitted < 0 && errno == EINTR);
+        if (submitted > 0)
+            to_submit -= std::min<unsigned>(to_submit, static_cast<unsigned>(submitted));
+    }
+    const unsigned tail = std::atomic_ref<unsigned>(*cq_tail).load(std::memory_order_acquire);
+    for (; head != tail; head++)
+    {
+        const io_uring_cqe& entry = cqes[head & cq_mask];
+        completions.push_back(completion{ static_cast<int>(entry.user_data), entry.res });
+    }
+    std::atomic_ref<unsigned>(*cq_head).store(head, std::memory_order_release);
+}
+#else
+ioQueue::fileHandle ioQueue::open_file(const char*, std::uint64_t&)
+{
+    return noFile;
+}
+
+void ioQueue::close_file(fileHandle)
+{
+}
+
+void ioQueue::read(int, fileHandle, std::uint64_t, std::uint32_t)
+{
+}
+
+void ioQueue::wait(std::vector<completion>& completions)
+{
+    completions.clear();
+}
+#endif
+
+// Counts batches of files with up to depth reads in flight. Every read
+// covers one block of a file plus the stateContext bytes before it, which
+// restore the scan state, so the blocks of one file can complete in any
+// order.
+// Without asynchronous reads on the system, files are counted one by one.
+class asyncReader
+{
+public:
+
+    static constexpr std::uint32_t block_size = 256 * 1024;
+
+    // Every slot holds a block, so a reader of the largest depth takes
+    // 1 GiB; io_uring also refuses rings beyond 32768 entries.
+    static constexpr int max_depth = 4096;
+
+    explicit asyncReader(int _depth)
+        : depth(std::max(1, _depth)), queue(depth, block_size + stateContext) {}
+
+    // Counts paths[i] into results[i].
+    void count_files(const std::vector<const char*>& paths, std::vector<countedResult>& results);
+
+private:
+
+    struct fileState {
+        ioQueue::fileHandle handle = ioQueue::noFile;
+        std::uint64_t size = 0;
+        std::uint64_t next = 0;
+        int in_flight = 0;
+        bool failed = false;
+    };
+
+    // A block [begin, begin + length) of a file waiting to be read.
+    struct range {
+        std::size_t file;
+        std::uint64_t begin;
+        std::uint32_t length;
+    };
+
+    static bool countSync(const char* path, counter& stats);
+
+    void issue(int slot, const range& block);
+
+    int depth;
+    ioQueue queue;
+    std::vector<range> slot_ranges;
+    std::vector<fileState> files;
+};
+
+bool asyncReader::countSync(const char* path, counter& stats)
+{
+    scanState state;
+    counter counted;
+    if (!readFileBlocks(path, [&](const char* data, std::size_t size) { countBytes(data, size, state, counted); }))
+        return false;
+    finishCount(state, counted);
+    stats = counted;
+    return true;
+}
+
+void asyncReader::issue(int slot, const range& block)
+{
+    const std::uint32_t before = static_cast<std::uint32_t>(std::min<std::uint64_t>(block.begin, stateContext));
+    slot_ranges[slot] = block;
+    files[block.file].in_flight++;
+    queue.read(slot, files[block.file].handle, block.begin - before, block.length + before);
+}
+
+void asyncReader::count_files(const std::vector<const char*>& paths, std::vector<countedResult>& results)
+{
+    results.assign(paths.size(), countedResult{});
+    if (!queue.ready())
+    {
+        for (std::size_t i = 0; i < paths.size(); i++)
+            results[i].opened = countSync(paths[i], results[i].stats);
+        return;
+    }
+
+    files.assign(paths.size(), fileState{});
+    slot_ranges.assign(depth, range{});
+    std::vector<int> free_slots;
+    for (int slot = depth - 1; slot >= 0; slot--)
+        free_slots.push_back(slot);
+    std::vector<range> retries;
+    std::vector<ioQueue::completion> completions;
+    std::size_t next_file = 0;
+    std::size_t open_files = 0;
+
+    auto finish = [&](std::size_t file)
+    {
+        fileState& state = files[file];
+        queue.close_file(state.handle);
+        releaseOpenFile();
+        state.handle = ioQueue::noFile;
+        open_files--;
+        if (state.failed)
+        {
+            results[file].stats = counter{};
+            results[file].opened = countSync(paths[file], results[file].stats);
+        }
+    };
+
+    while (true)
+    {
+        // Fill the free slots: retries first, then the next blocks of the
+        // newest open file, then new files.
+        while (!free_slots.empty())
+        {
+            if (!retries.empty())
+            {
+                issue(free_slots.back(), retries.back());
+                free_slots.pop_back();
+                retries.pop_back();
+                continue;
+            }
+            if (open_files > 0 && next_file > 0)
+            {
+                const std::size_t current = next_file - 1;
+                fileState& state = files[current];
+                if (state.handle != ioQueue::noFile && state.next < state.size)
+                {
+                    const std::uint32_t length = static_cast<std::uint32_t>(std::min<std::uint64_t>(block_size, state.size - state.next));
+                    issue(free_slots.back(), range{ current, state.next, length });
+                    free_slots.pop_back();
+                    state.next += length;
+                    continue;
+                }
+            }
+            // Without room for another open file the reads in flight are
+            // waited for first; a thread holding none waits for room.
+            if (next_file == paths.size() || open_files >= static_cast<std::size_t>(depth) || !tryAcquireOpenFile())
+                break;
+
+            const std::size_t file = next_file++;
+            fileState& state = files[file];
+            {
+                ASD_PROFILE_PHASE(profilePhase::open);
+                state.handle = queue.open_file(paths[file], state.size);
+            }
+            if (state.handle == ioQueue::noFile || state.size == 0)
+            {
+                // Not a regular file or an empty one, which may still be a
+                // pseudo file with content: the stream reader handles both.
+                if (state.handle != ioQueue::noFile)
+                    queue.close_file(state.handle);
+                releaseOpenFile();
+                state.handle = ioQueue::noFile;
+                results[file].opened = countSync(paths[file], results[file].stats);
+                continue;
+            }
+            results[file].opened = true;
+            ASD_PROFILE_EVENT(profileEvent::filesOpened, 1);
+            open_files++;
+        }
+        if (free_slots.size() == static_cast<std::size_t>(depth))
+            break;
+
+        {
+            ASD_PROFILE_PHASE(profilePhase::read);
+            queue.wait(completions);
+        }
+        for (const auto& done : completions)
+        {
+            const range block = slot_ranges[done.slot];
+            fileState& state = files[block.file];
+            const std::uint32_t before = static_cast<std::uint32_t>(std::min<std::uint64_t>(block.begin, stateContext));
+            free_slots.push_back(done.slot);
+            state.in_flight--;
+
+            if (done.result < static_cast<std::int64_t>(before) || (done.result == before && block.length > 0))
+            {
+                // An error, or the file shrank: it is counted again on its own.
+                state.failed = true;
+                state.next = state.size;
+                retries.erase(std::remove_if(retries.begin(), retries.end(), [&](const range& retry) { return retry.file == block.file; }), retries.end());
+            }
+            else if (!state.failed)
+            {
+                const std::uint32_t got = static_cast<std::uint32_t>(done.result) - before;
+                ASD_PROFILE_EVENT(profileEvent::bytesRead, got);
+                const char* data = queue.buffer(done.slot);
+                scanState scan = stateBefore(data, before);
+                counter stats;
+                countBytes(data + before, got, scan, stats);
+                if (block.begin + got == state.size)
+                    finishCount(scan, stats);
+                results[block.file].stats += stats;
+                if (got < block.length)
+                    retries.push_back(range{ block.file, block.begin + got, block.length - got });
+            }
+            const bool pending = std::any_of(retries.begin(), retries.end(), [&](const range& retry) { return retry.file == block.file; });
+            if (state.in_flight == 0 && state.next >= state.size && !pending && state.handle != ioQueue::noFile)
+                finish(block.file);
+        }
+    }
+}
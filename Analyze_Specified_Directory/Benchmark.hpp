@@ -0,0 +1,168 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// All timings of one benchmarked thread count, in seconds.
+struct benchmarkSeries {
+    int threads = 1;
+    std::vector<double> samples;
+};
+
+// Summary statistics of a series of samples.
+struct sampleStats {
+    double min = 0;
+    double median = 0;
+    double p95 = 0;
+    double mean = 0;
+    double stddev = 0;
+};
+
+inline sampleStats computeStats(std::vector<double> samples)
+{
+    sampleStats stats;
+    if (samples.empty())
+        return stats;
+
+    std::sort(samples.begin(), samples.end());
+    const std::size_t n = samples.size();
+    stats.min = samples.front();
+    stats.median = n % 2 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+    stats.p95 = samples[static_cast<std::size_t>(std::ceil(0.95 * n)) - 1];
+
+    double sum = 0;
+    for (double sample : samples)
+        sum += sample;
+    stats.mean = sum / n;
+
+    if (n > 1)
+    {
+        double squares = 0;
+        for (double sample : samples)
+            squares += (sample - stats.mean) * (sample - stats.mean);
+        stats.stddev = std::sqrt(squares / (n - 1));
+    }
+    return stats;
+}
+
+// Timings of one thread count, with speedup and parallel efficiency
+// relative to the median of 1 thread, or of the smallest measured count.
+struct seriesSummary {
+    int threads = 1;
+    std::size_t runs = 0;
+    sampleStats stats;
+    double speedup = 0;
+    double efficiency = 0;
+};
+
+inline std::vector<seriesSummary> summarizeBenchmark(const std::vector<benchmarkSeries>& series)
+{
+    std::vector<seriesSummary> rows;
+    if (series.empty())
+        return rows;
+
+    const auto base = std::min_element(series.begin(), series.end(),
+        [](const benchmarkSeries& a, const benchmarkSeries& b) { return a.threads < b.threads; });
+    const sampleStats baseStats = computeStats(base->samples);
+
+    for (const auto& entry : series)
+    {
+        seriesSummary row;
+        row.threads = entry.threads;
+        row.runs = entry.samples.size();
+        row.stats = computeStats(entry.samples);
+        row.speedup = row.stats.median > 0 ? baseStats.median / row.stats.median : 0;
+        row.efficiency = row.speedup * base->threads / entry.threads;
+        rows.push_back(row);
+    }
+    return rows;
+}
+
+// Prints one row per thread count.
+inline void printBenchmark(const std::vector<benchmarkSeries>& series)
+{
+    if (series.empty())
+        return;
+
+    std::cout << std::setw(8) << "threads" << std::setw(6) << "runs"
+        << std::setw(12) << "min [s]" << std::setw(12) << "median [s]" << std::setw(12) << "p95 [s]"
+        << std::setw(12) << "stddev [s]" << std::setw(10) << "speedup" << std::setw(12) << "efficiency" << std::endl;
+
+    for (const auto& row : summarizeBenchmark(series))
+    {
+        std::cout << std::fixed << std::setprecision(6)
+            << std::setw(8) << row.threads << std::setw(6) << row.runs
+            << std::setw(12) << row.stats.min << std::setw(12) << row.stats.median << std::setw(12) << row.stats.p95
+            << std::setw(12) << row.stats.stddev << std::setprecision(2) << std::setw(10) << row.speedup
+            << std::setw(11) << row.efficiency * 100 << "%" << std::endl;
+    }
+    std::cout << std::setprecision(6);
+}
+
+// Asks the system to forget the cached content of one file. On Windows
+// opening a file without buffering makes the cache manager purge it.
+inline void dropFileCache(const std::filesystem::path& file)
+{
+#ifdef _WIN32
+    HANDLE handle = CreateFileW(file.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+        nullptr, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING, nullptr);
+    if (handle != INVALID_HANDLE_VALUE)
+        CloseHandle(handle);
+#else
+    const int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+#endif
+}
+
+// Evicts the scanned files from the page cache, so the next run reads them
+// from the device. Dropping the whole cache needs root on Linux, otherwise
+// every file below the paths is evicted one by one.
+inline void dropFileCaches(const std::vector<std::string>& paths)
+{
+#ifndef _WIN32
+    sync();
+    {
+        std::ofstream dropCaches("/proc/sys/vm/drop_caches");
+        if (dropCaches << "3" << std::flush)
+            return;
+    }
+#endif
+    for (const auto& path : paths)
+    {
+        std::error_code error;
+        if (std::filesystem::is_regular_file(path, error))
+        {
+            dropFileCache(path);
+            continue;
+        }
+        auto entry = std::filesystem::recursive_directory_iterator(path,
+            std::filesystem::directory_options::skip_permission_denied, error);
+        for (; !error && entry != std::filesystem::recursive_directory_iterator(); entry.increment(error))
+        {
+            if (entry->is_regular_file(error))
+                dropFileCache(entry->path());
+        }
+    }
+}
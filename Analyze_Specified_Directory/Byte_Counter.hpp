@@ -0,0 +1,817 @@
+#pragma once
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "Phase_Profiler.hpp"
+#include "Stats_Counter.hpp"
+#include "Text_Encoding.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define ASD_SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+#define ASD_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+// Lets GCC and Clang compile a single function for a wider instruction set,
+// MSVC accepts the intrinsics without it.
+#if defined(__GNUC__) || defined(__clang__)
+#define ASD_TARGET(isa) __attribute__((target(isa)))
+#else
+#define ASD_TARGET(isa)
+#endif
+
+// Rules used by the counter:
+// - a line ends at '\n', a '\r' directly before it belongs to the line ending,
+// - a line is empty when nothing but that line ending is in it,
+// - a word is a run of characters other than white space,
+// - which characters are letters and white space depends on the encoding,
+//   see textEncoding.
+
+// State carried between consecutive blocks of one file, so that lines,
+// words and characters crossing a block boundary are counted exactly once.
+struct scanState {
+    bool lineHasBytes = false;
+    bool pendingCR = false;
+    bool inWord = false;
+    // UTF-8 only: continuation bytes the last code point still misses, and
+    // its bits so far.
+    std::uint8_t missingBytes = 0;
+    std::uint32_t codePoint = 0;
+};
+
+// Bytes in front of an offset stateBefore may look at.
+constexpr std::size_t stateContext = 8;
+
+// Clears the parts of the state a metric set doesn't track, so finishCount
+// never adds lines that weren't asked for.
+template <unsigned Metrics>
+inline void dropUntrackedState(scanState& state)
+{
+    if constexpr (!(Metrics & metricLines))
+    {
+        state.lineHasBytes = false;
+        state.pendingCR = false;
+    }
+    if constexpr (!(Metrics & metricWords))
+        state.inWord = false;
+    if constexpr (!(Metrics & (metricWords | metricLetters)))
+    {
+        state.missingBytes = 0;
+        state.codePoint = 0;
+    }
+}
+
+// Moves the line state over bytes holding no '\n', following the rules of
+// countBytesScalar: only a single '\r' that starts a line is no content.
+inline void skipLineBytes(const char* begin, const char* end, scanState& state)
+{
+    if (begin == end)
+        return;
+    if (end - begin >= 2 || *begin != '\r' || state.pendingCR)
+        state.lineHasBytes = true;
+    state.pendingCR = end[-1] == '\r';
+}
+
+// Counts only empty and non-empty lines, jumping from one '\n' to the next
+// with memchr and looking at nothing in between.
+inline void countLinesScalar(const char* data, std::size_t size, scanState& state, counter& stats)
+{
+    const char* position = data;
+    const char* const end = data + size;
+    while (position < end)
+    {
+        const char* newline = static_cast<const char*>(std::memchr(position, '\n', static_cast<std::size_t>(end - position)));
+        if (newline == nullptr)
+            break;
+        skipLineBytes(position, newline, state);
+        if (state.lineHasBytes)
+            stats.nonEmptyLines++;
+        else
+            stats.emptyLines++;
+        state.lineHasBytes = false;
+        state.pendingCR = false;
+        position = newline + 1;
+    }
+    skipLineBytes(position, end, state);
+    dropUntrackedState<metricLines>(state);
+}
+
+// Moves the line state over one byte and counts the line it ends.
+template <unsigned Metrics>
+inline void countLineByte(unsigned char c, scanState& state, counter& stats)
+{
+    if (c == '\n')
+    {
+        if constexpr ((Metrics & metricLines) != 0)
+        {
+            if (state.lineHasBytes)
+                stats.nonEmptyLines++;
+            else
+                stats.emptyLines++;
+        }
+        state.lineHasBytes = false;
+        state.pendingCR = false;
+    }
+    else if (c == '\r')
+    {
+        if (state.pendingCR)
+            state.lineHasBytes = true;
+        state.pendingCR = true;
+    }
+    else
+    {
+        state.lineHasBytes = true;
+        state.pendingCR = false;
+    }
+}
+
+// Counts one character of the given class.
+template <unsigned Metrics>
+inline void countCharacter(std::uint8_t classes, scanState& state, counter& stats)
+{
+    if (classes & spaceClass)
+    {
+        state.inWord = false;
+        return;
+    }
+    if constexpr ((Metrics & metricWords) != 0)
+    {
+        if (!state.inWord)
+            stats.numWords++;
+    }
+    state.inWord = true;
+    if constexpr ((Metrics & metricLetters) != 0)
+    {
+        if (classes & letterClass)
+            stats.letters++;
+    }
+}
+
+// Decodes UTF-8 one byte at a time. A code point is counted at its last
+// byte, so a block ending inside one leaves it to the next block.
+template <unsigned Metrics>
+inline void countBytesUtf8(const char* data, std::size_t size, scanState& state, counter& stats)
+{
+    for (std::size_t i = 0; i < size; i++)
+    {
+        const unsigned char c = static_cast<unsigned char>(data[i]);
+        if constexpr ((Metrics & metricLines) != 0)
+            countLineByte<Metrics>(c, state, stats);
+        if (state.missingBytes != 0)
+        {
+            if (isContinuation(c))
+            {
+                state.codePoint = (state.codePoint << 6) | (c & 0x3F);
+                if (--state.missingBytes == 0)
+                    countCharacter<Metrics>(codePointClass(state.codePoint), state, stats);
+                continue;
+            }
+            // The sequence broke off, what it had is one character.
+            state.missingBytes = 0;
+            countCharacter<Metrics>(0, state, stats);
+        }
+        const int continuations = continuationBytes(c);
+        if (continuations == 0)
+        {
+            countCharacter<Metrics>(asciiClasses[c], state, stats);
+        }
+        else if (continuations < 0)
+        {
+            countCharacter<Metrics>(0, state, stats);
+        }
+        else
+        {
+            state.missingBytes = static_cast<std::uint8_t>(continuations);
+            state.codePoint = c & (0x3F >> continuations);
+        }
+    }
+    dropUntrackedState<Metrics>(state);
+}
+
+// Counts the metrics of one block of bytes, one byte at a time; lines only
+// are counted with memchr.
+template <unsigned Metrics = allMetrics, textEncoding Encoding = textEncoding::ascii>
+inline void countBytesScalar(const char* data, std::size_t size, scanState& state, counter& stats)
+{
+    if constexpr (Metrics == metricLines)
+    {
+        countLinesScalar(data, size, state, stats);
+        return;
+    }
+    else if constexpr (Encoding == textEncoding::utf8)
+    {
+        countBytesUtf8<Metrics>(data, size, state, stats);
+        return;
+    }
+    else if constexpr (Metrics == metricLetters)
+    {
+        const byteClassTable& classes = byteClasses<Encoding>();
+        for (std::size_t i = 0; i < size; i++)
+            stats.letters += (classes[static_cast<unsigned char>(data[i])] & letterClass) != 0;
+        dropUntrackedState<Metrics>(state);
+        return;
+    }
+    const byteClassTable& classes = byteClasses<Encoding>();
+    for (std::size_t i = 0; i < size; i++)
+    {
+        const unsigned char c = static_cast<unsigned char>(data[i]);
+        countLineByte<Metrics>(c, state, stats);
+        countCharacter<Metrics>(classes[c], state, stats);
+    }
+    dropUntrackedState<Metrics>(state);
+}
+
+// Tells whether the UTF-8 text in front of data[end] ends with white space.
+inline bool endsWithUtf8Space(const char* data, std::size_t end)
+{
+    if (end == 0)
+        return false;
+    const unsigned char last = static_cast<unsigned char>(data[end - 1]);
+    if (last < 0x80)
+        return (asciiClasses[last] & spaceClass) != 0;
+    if (!isContinuation(last))
+        return false;
+    for (std::size_t length = 2; length <= 4 && length <= end; length++)
+    {
+        const unsigned char lead = static_cast<unsigned char>(data[end - length]);
+        if (isContinuation(lead))
+            continue;
+        if (continuationBytes(lead) != static_cast<int>(length) - 1)
+            return false;
+        std::uint32_t codePoint = lead & (0x3F >> (length - 1));
+        for (std::size_t i = end - length + 1; i < end; i++)
+            codePoint = (codePoint << 6) | (static_cast<unsigned char>(data[i]) & 0x3F);
+        return (codePointClass(codePoint) & spaceClass) != 0;
+    }
+    return false;
+}
+
+// Rebuilds the state the counter has right before data[offset] from at most
+// stateContext bytes in front of it, so any byte range can be counted on
+// its own.
+template <textEncoding Encoding>
+inline scanState encodedStateBefore(const char* data, std::size_t offset)
+{
+    scanState state;
+    if (offset == 0)
+        return state;
+    const unsigned char last = static_cast<unsigned char>(data[offset - 1]);
+    if (last == '\r')
+    {
+        state.lineHasBytes = offset >= 2 && data[offset - 2] != '\n';
+        state.pendingCR = true;
+    }
+    else if (last != '\n')
+    {
+        state.lineHasBytes = true;
+    }
+
+    if constexpr (Encoding == textEncoding::utf8)
+    {
+        // A sequence still open at the offset, then the character before it.
+        std::size_t end = offset;
+        for (std::size_t back = 1; back <= 3 && back <= offset; back++)
+        {
+            const unsigned char c = static_cast<unsigned char>(data[offset - back]);
+            if (isContinuation(c))
+                continue;
+            const int continuations = continuationBytes(c);
+            if (continuations >= static_cast<int>(back))
+            {
+                state.missingBytes = static_cast<std::uint8_t>(continuations - (back - 1));
+                state.codePoint = c & (0x3F >> continuations);
+                for (std::size_t i = offset - back + 1; i < offset; i++)
+                    state.codePoint = (state.codePoint << 6) | (static_cast<unsigned char>(data[i]) & 0x3F);
+                end = offset - back;
+            }
+            break;
+        }
+        state.inWord = end > 0 && !endsWithUtf8Space(data, end);
+    }
+    else
+    {
+        state.inWord = (byteClasses<Encoding>()[last] & spaceClass) == 0;
+    }
+    return state;
+}
+
+// Accounts for the last line when the file does not end with a newline.
+inline void finishCount(const scanState& state, counter& stats)
+{
+    if (state.lineHasBytes)
+        stats.nonEmptyLines++;
+    else if (state.pendingCR)
+        stats.emptyLines++;
+}
+
+// Bit i of each mask describes byte i of a 64-byte block. The space mask
+// covers all ASCII white space, '\n' and '\r' included; the masks after
+// high are only filled in for UTF-8 and may hold stray ASCII bits.
+struct blockMasks {
+    std::uint64_t newline = 0;
+    std::uint64_t carriageReturn = 0;
+    std::uint64_t space = 0;
+    std::uint64_t letter = 0;
+    std::uint64_t high = 0;
+    std::uint64_t continuation = 0;
+    std::uint64_t fromE0 = 0;
+    std::uint64_t fromF0 = 0;
+    // Lead bytes all of whose code points are letters: C4-CA (U+0100 to
+    // U+02BF), D0-D1 (Cyrillic), E5-E9 (CJK) and EB-EC (Hangul).
+    std::uint64_t letterLead = 0;
+    // Leads whose code points are letters but for some second bytes:
+    // C3 but for × (97) and ÷ (B7), E4 but for U+4DC0 to U+4DFF (B7).
+    std::uint64_t leadC3 = 0;
+    std::uint64_t leadE4 = 0;
+    std::uint64_t byte97 = 0;
+    std::uint64_t byteB7 = 0;
+};
+
+// Turns the masks of the first length bytes of a block into counts and
+// moves the state past them, following exactly the rules of
+// countBytesScalar. Only the masks the metric set needs are filled in, and
+// none has bits from length up.
+template <unsigned Metrics, textEncoding Encoding>
+inline void accumulateBlock(const blockMasks& masks, const char* block, std::size_t length, scanState& state, counter& stats)
+{
+    if constexpr ((Metrics & metricLines) != 0)
+    {
+        // A newline ends an empty line when the byte before it starts a line,
+        // or when that byte is a '\r' directly following a line start.
+        const std::uint64_t lineStart = !state.lineHasBytes && !state.pendingCR;
+        const std::uint64_t afterLineStart = (masks.newline << 1) | lineStart;
+        const std::uint64_t afterCR = (masks.carriageReturn << 1) | state.pendingCR;
+        const std::uint64_t twoAfterLineStart = (masks.newline << 2) | (lineStart << 1) | !state.lineHasBytes;
+        const std::uint64_t emptyEnds = masks.newline & (afterLineStart | (afterCR & twoAfterLineStart));
+
+        const int newlines = std::popcount(masks.newline);
+        const int empty = std::popcount(emptyEnds);
+        stats.emptyLines += empty;
+        stats.nonEmptyLines += newlines - empty;
+    }
+    if constexpr ((Metrics & metricWords) != 0)
+    {
+        const std::uint64_t valid = length == 64 ? ~std::uint64_t(0) : (std::uint64_t(1) << length) - 1;
+        const std::uint64_t wordStarts = ~masks.space & ((masks.space << 1) | !state.inWord) & valid;
+        stats.numWords += std::popcount(wordStarts);
+    }
+    if constexpr ((Metrics & metricLetters) != 0)
+        stats.letters += std::popcount(masks.letter);
+
+    // The last byte is ASCII or ends a whole sequence, so the masks tell
+    // whether a word is open.
+    const bool inWord = ((masks.space >> (length - 1)) & 1) == 0;
+    state = encodedStateBefore<textEncoding::ascii>(block, length);
+    if constexpr ((Metrics & metricWords) != 0)
+        state.inWord = inWord;
+}
+
+// Which masks a metric set needs in a given encoding.
+template <unsigned Metrics>
+constexpr bool needsLineMasks = (Metrics & metricLines) != 0;
+template <unsigned Metrics>
+constexpr bool needsSpaceMask = (Metrics & metricWords) != 0;
+template <unsigned Metrics>
+constexpr bool needsLetterMask = (Metrics & metricLetters) != 0;
+template <unsigned Metrics, textEncoding Encoding>
+constexpr bool needsHighMask = Encoding != textEncoding::ascii && (Metrics & (metricWords | metricLetters)) != 0;
+
+template <unsigned Metrics, textEncoding Encoding>
+constexpr bool needsUtf8Masks = Encoding == textEncoding::utf8 && needsHighMask<Metrics, Encoding>;
+
+// Counts a block of UTF-8 with bytes from 0x80 up. The sequences are
+// checked against the lead bytes all at once, then every lead byte is
+// decoded to mark its code point in the masks. A sequence running past the
+// block is left to the next one, and a block holding anything but whole
+// sequences goes to the scalar decoder. Returns the bytes counted.
+template <unsigned Metrics>
+inline std::size_t countUtf8Block(blockMasks& masks, const char* block, scanState& state, counter& stats)
+{
+    const std::uint64_t continuations = masks.high & masks.continuation;
+    const std::uint64_t leads = masks.high & ~continuations;
+    std::uint64_t twoBytes = leads & ~masks.fromE0;
+    std::uint64_t threeBytes = masks.high & masks.fromE0 & ~masks.fromF0;
+    std::uint64_t fourBytes = masks.high & masks.fromF0;
+
+    const std::uint64_t spilling = (twoBytes >> 63 << 63) | (threeBytes >> 62 << 62) | (fourBytes >> 61 << 61);
+    const std::size_t length = spilling == 0 ? 64 : static_cast<std::size_t>(std::countr_zero(spilling));
+    const std::uint64_t valid = length == 64 ? ~std::uint64_t(0) : (std::uint64_t(1) << length) - 1;
+    twoBytes &= valid;
+    threeBytes &= valid;
+    fourBytes &= valid;
+    const std::uint64_t expected = (twoBytes << 1) | (threeBytes << 1) | (threeBytes << 2)
+        | (fourBytes << 1) | (fourBytes << 2) | (fourBytes << 3);
+    bool whole = state.missingBytes == 0 && (continuations & valid) == expected;
+
+    if (whole)
+    {
+        // Letters of the common pages come straight from the masks. Any
+        // other lead byte is decoded without branches from a copy that can
+        // be read three bytes past the block; C0, C1 and F5 to FF start no
+        // sequence and send the block to the scalar decoder.
+        const std::uint64_t exceptions = ((masks.byte97 | masks.byteB7) & masks.high) >> 1;
+        masks.letter |= (masks.letterLead | (masks.leadC3 & ~exceptions) | (masks.leadE4 & ~((masks.byteB7 & masks.high) >> 1))) & leads;
+        unsigned char bytes[64 + 3] = {};
+        std::memcpy(bytes, block, length);
+        bool invalid = false;
+        for (std::uint64_t rest = leads & valid & ~(masks.letterLead | masks.leadC3 | masks.leadE4); rest != 0; rest &= rest - 1)
+        {
+            const int bit = std::countr_zero(rest);
+            invalid |= bytes[bit] < 0xC2 || bytes[bit] > 0xF4;
+            const int following = 1 + int((threeBytes >> bit) & 1) + 2 * int((fourBytes >> bit) & 1);
+            const std::uint32_t codePoint = (std::uint32_t(bytes[bit] & (0x3F >> following)) << 18 | std::uint32_t(bytes[bit + 1] & 0x3F) << 12
+                | std::uint32_t(bytes[bit + 2] & 0x3F) << 6 | std::uint32_t(bytes[bit + 3] & 0x3F)) >> (6 * (3 - following));
+            const std::uint64_t classes = codePointClass(codePoint);
+            masks.space |= ((classes & spaceClass) * ((std::uint64_t(2) << following) - 1)) << bit;
+            masks.letter |= (classes >> 1) << bit;
+        }
+        whole = !invalid;
+    }
+    if (!whole)
+    {
+        countBytesUtf8<Metrics>(block, length, state, stats);
+        return length;
+    }
+    masks.newline &= valid;
+    masks.carriageReturn &= valid;
+    masks.space &= valid;
+    masks.letter &= valid;
+    accumulateBlock<Metrics, textEncoding::utf8>(masks, block, length, state, stats);
+    return length;
+}
+
+// Counts one 64-byte block from its masks and returns the bytes counted.
+template <unsigned Metrics, textEncoding Encoding>
+inline std::size_t countBlock(blockMasks& masks, const char* block, scanState& state, counter& stats)
+{
+    if constexpr (needsUtf8Masks<Metrics, Encoding>)
+    {
+        if (masks.high != 0 || state.missingBytes != 0)
+            return countUtf8Block<Metrics>(masks, block, state, stats);
+    }
+    accumulateBlock<Metrics, Encoding>(masks, block, 64, state, stats);
+    return 64;
+}
+
+#ifdef ASD_SIMD_X86
+// Bit i tells whether byte i is from first to last.
+ASD_TARGET("sse2")
+inline std::uint64_t rangeMaskSSE2(__m128i bytes, unsigned char first, unsigned char last)
+{
+    const __m128i shifted = _mm_add_epi8(bytes, _mm_set1_epi8(static_cast<char>(0x80 - first)));
+    return std::uint16_t(_mm_movemask_epi8(_mm_cmplt_epi8(shifted, _mm_set1_epi8(static_cast<char>(0x80 + last - first + 1)))));
+}
+
+// Fills in the masks of a block with bytes from 0x80 up: the Latin-1
+// letters and white space, or what countUtf8Block needs.
+template <textEncoding Encoding>
+ASD_TARGET("sse2")
+inline void highMasksSSE2(const char* block, blockMasks& masks)
+{
+    for (int part = 0; part < 4; part++)
+    {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + part * 16));
+        const int shift = part * 16;
+        if constexpr (Encoding == textEncoding::latin1)
+        {
+            masks.letter |= (rangeMaskSSE2(bytes, 0xC0, 0xD6) | rangeMaskSSE2(bytes, 0xD8, 0xF6) | rangeMaskSSE2(bytes, 0xF8, 0xFF)
+                | rangeMaskSSE2(bytes, 0xAA, 0xAA) | rangeMaskSSE2(bytes, 0xB5, 0xB5) | rangeMaskSSE2(bytes, 0xBA, 0xBA)) << shift;
+            masks.space |= (rangeMaskSSE2(bytes, 0x85, 0x85) | rangeMaskSSE2(bytes, 0xA0, 0xA0)) << shift;
+        }
+        else
+        {
+            masks.continuation |= rangeMaskSSE2(bytes, 0x80, 0xBF) << shift;
+            masks.fromE0 |= rangeMaskSSE2(bytes, 0xE0, 0xFF) << shift;
+            masks.fromF0 |= rangeMaskSSE2(bytes, 0xF0, 0xFF) << shift;
+            masks.letterLead |= (rangeMaskSSE2(bytes, 0xC4, 0xCA) | rangeMaskSSE2(bytes, 0xD0, 0xD1)
+                | rangeMaskSSE2(bytes, 0xE5, 0xE9) | rangeMaskSSE2(bytes, 0xEB, 0xEC)) << shift;
+            masks.leadC3 |= rangeMaskSSE2(bytes, 0xC3, 0xC3) << shift;
+            masks.leadE4 |= rangeMaskSSE2(bytes, 0xE4, 0xE4) << shift;
+            masks.byte97 |= rangeMaskSSE2(bytes, 0x97, 0x97) << shift;
+            masks.byteB7 |= rangeMaskSSE2(bytes, 0xB7, 0xB7) << shift;
+        }
+    }
+}
+
+template <unsigned Metrics = allMetrics, textEncoding Encoding = textEncoding::ascii>
+ASD_TARGET("sse2")
+inline void countBytesSSE2(const char* data, std::size_t size, scanState& state, counter& stats)
+{
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i carriageReturn = _mm_set1_epi8('\r');
+    const __m128i space = _mm_set1_epi8(' ');
+    // '\t' to '\r' moved to the bottom of the signed range.
+    const __m128i controlShift = _mm_set1_epi8(static_cast<char>(0x80 - '\t'));
+    const __m128i controlEnd = _mm_set1_epi8(static_cast<char>(0x80 + 5));
+    const __m128i caseBit = _mm_set1_epi8(0x20);
+    const __m128i beforeA = _mm_set1_epi8('a' - 1);
+    const __m128i afterZ = _mm_set1_epi8('z' + 1);
+
+    std::size_t i = 0;
+    while (i + 64 <= size)
+    {
+        blockMasks masks;
+        for (int part = 0; part < 4; part++)
+        {
+            const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + part * 16));
+            const int shift = part * 16;
+            if constexpr (needsLineMasks<Metrics>)
+            {
+                masks.newline |= std::uint64_t(std::uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline)))) << shift;
+                masks.carriageReturn |= std::uint64_t(std::uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, carriageReturn)))) << shift;
+            }
+            if constexpr (needsSpaceMask<Metrics>)
+            {
+                const __m128i control = _mm_cmplt_epi8(_mm_add_epi8(bytes, controlShift), controlEnd);
+                masks.space |= std::uint64_t(std::uint16_t(_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(bytes, space), control)))) << shift;
+            }
+            if constexpr (needsLetterMask<Metrics>)
+            {
+                const __m128i folded = _mm_or_si128(bytes, caseBit);
+                const __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(folded, beforeA), _mm_cmplt_epi8(folded, afterZ));
+                masks.letter |= std::uint64_t(std::uint16_t(_mm_movemask_epi8(letter))) << shift;
+            }
+            if constexpr (needsHighMask<Metrics, Encoding>)
+                masks.high |= std::uint64_t(std::uint16_t(_mm_movemask_epi8(bytes))) << shift;
+        }
+        if constexpr (needsHighMask<Metrics, Encoding>)
+        {
+            if (masks.high != 0)
+                highMasksSSE2<Encoding>(data + i, masks);
+        }
+        i += countBlock<Metrics, Encoding>(masks, data + i, state, stats);
+    }
+    countBytesScalar<Metrics, Encoding>(data + i, size - i, state, stats);
+}
+
+ASD_TARGET("avx2")
+inline std::uint64_t rangeMaskAVX2(__m256i bytes, unsigned char first, unsigned char last)
+{
+    const __m256i shifted = _mm256_add_epi8(bytes, _mm256_set1_epi8(static_cast<char>(0x80 - first)));
+    return std::uint32_t(_mm256_movemask_epi8(_mm256_cmpgt_epi8(_mm256_set1_epi8(static_cast<char>(0x80 + last - first + 1)), shifted)));
+}
+
+template <textEncoding Encoding>
+ASD_TARGET("avx2")
+inline void highMasksAVX2(const char* block, blockMasks& masks)
+{
+    for (int part = 0; part < 2; part++)
+    {
+        const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + part * 32));
+        const int shift = part * 32;
+        if constexpr (Encoding == textEncoding::latin1)
+        {
+            masks.letter |= (rangeMaskAVX2(bytes, 0xC0, 0xD6) | rangeMaskAVX2(bytes, 0xD8, 0xF6) | rangeMaskAVX2(bytes, 0xF8, 0xFF)
+                | rangeMaskAVX2(bytes, 0xAA, 0xAA) | rangeMaskAVX2(bytes, 0xB5, 0xB5) | rangeMaskAVX2(bytes, 0xBA, 0xBA)) << shift;
+            masks.space |= (rangeMaskAVX2(bytes, 0x85, 0x85) | rangeMaskAVX2(bytes, 0xA0, 0xA0)) << shift;
+        }
+        else
+        {
+            masks.continuation |= rangeMaskAVX2(bytes, 0x80, 0xBF) << shift;
+            masks.fromE0 |= rangeMaskAVX2(bytes, 0xE0, 0xFF) << shift;
+            masks.fromF0 |= rangeMaskAVX2(bytes, 0xF0, 0xFF) << shift;
+            masks.letterLead |= (rangeMaskAVX2(bytes, 0xC4, 0xCA) | rangeMaskAVX2(bytes, 0xD0, 0xD1)
+                | rangeMaskAVX2(bytes, 0xE5, 0xE9) | rangeMaskAVX2(bytes, 0xEB, 0xEC)) << shift;
+            masks.leadC3 |= rangeMaskAVX2(bytes, 0xC3, 0xC3) << shift;
+            masks.leadE4 |= rangeMaskAVX2(bytes, 0xE4, 0xE4) << shift;
+            masks.byte97 |= rangeMaskAVX2(bytes, 0x97, 0x97) << shift;
+            masks.byteB7 |= rangeMaskAVX2(bytes, 0xB7, 0xB7) << shift;
+        }
+    }
+}
+
+template <unsigned Metrics = allMetrics, textEncoding Encoding = textEncoding::ascii>
+ASD_TARGET("avx2")
+inline void countBytesAVX2(const char* data, std::size_t size, scanState& state, counter& stats)
+{
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i carriageReturn = _mm256_set1_epi8('\r');
+    const __m256i space = _mm256_set1_epi8(' ');
+    // '\t' to '\r' moved to the bottom of the signed range.
+    const __m256i controlShift = _mm256_set1_epi8(static_cast<char>(0x80 - '\t'));
+    const __m256i controlEnd = _mm256_set1_epi8(static_cast<char>(0x80 + 5));
+    const __m256i caseBit = _mm256_set1_epi8(0x20);
+    const __m256i beforeA = _mm256_set1_epi8('a' - 1);
+    const __m256i afterZ = _mm256_set1_epi8('z' + 1);
+
+    std::size_t i = 0;
+    while (i + 64 <= size)
+    {
+        blockMasks masks;
+        for (int part = 0; part < 2; part++)
+        {
+            const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + part * 32));
+            const int shift = part * 32;
+            if constexpr (needsLineMasks<Metrics>)
+            {
+                masks.newline |= std::uint64_t(std::uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, newline)))) << shift;
+                masks.carriageReturn |= std::uint64_t(std::uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, carriageReturn)))) << shift;
+            }
+            if constexpr (needsSpaceMask<Metrics>)
+            {
+                const __m256i control = _mm256_cmpgt_epi8(controlEnd, _mm256_add_epi8(bytes, controlShift));
+                masks.space |= std::uint64_t(std::uint32_t(_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(bytes, space), control)))) << shift;
+            }
+            if constexpr (needsLetterMask<Metrics>)
+            {
+                const __m256i folded = _mm256_or_si256(bytes, caseBit);
+                const __m256i letter = _mm256_and_si256(_mm256_cmpgt_epi8(folded, beforeA), _mm256_cmpgt_epi8(afterZ, folded));
+                masks.letter |= std::uint64_t(std::uint32_t(_mm256_movemask_epi8(letter))) << shift;
+            }
+            if constexpr (needsHighMask<Metrics, Encoding>)
+                masks.high |= std::uint64_t(std::uint32_t(_mm256_movemask_epi8(bytes))) << shift;
+        }
+        if constexpr (needsHighMask<Metrics, Encoding>)
+        {
+            if (masks.high != 0)
+                highMasksAVX2<Encoding>(data + i, masks);
+        }
+        i += countBlock<Metrics, Encoding>(masks, data + i, state, stats);
+    }
+    countBytesScalar<Metrics, Encoding>(data + i, size - i, state, stats);
+}
+
+inline bool cpuHasAVX2()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    __cpuid(info, 1);
+    const bool osSavesYmm = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+    __cpuidex(info, 7, 0);
+    return osSavesYmm && (info[1] & (1 << 5));
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+#ifdef ASD_SIMD_NEON
+// Packs a 16-lane comparison result into 16 bits, lane i into bit i.
+inline std::uint64_t neonMovemask(uint8x16_t lanes)
+{
+    static const uint8_t weights[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+    const uint8x16_t bits = vandq_u8(lanes, vld1q_u8(weights));
+    return std::uint64_t(vaddv_u8(vget_low_u8(bits))) | (std::uint64_t(vaddv_u8(vget_high_u8(bits))) << 8);
+}
+
+inline std::uint64_t rangeMaskNEON(uint8x16_t bytes, unsigned char first, unsigned char last)
+{
+    return neonMovemask(vcleq_u8(vsubq_u8(bytes, vdupq_n_u8(first)), vdupq_n_u8(last - first)));
+}
+
+template <textEncoding Encoding>
+inline void highMasksNEON(const char* block, blockMasks& masks)
+{
+    for (int part = 0; part < 4; part++)
+    {
+        const uint8x16_t bytes = vld1q_u8(reinterpret_cast<const uint8_t*>(block + part * 16));
+        const int shift = part * 16;
+        if constexpr (Encoding == textEncoding::latin1)
+        {
+            masks.letter |= (rangeMaskNEON(bytes, 0xC0, 0xD6) | rangeMaskNEON(bytes, 0xD8, 0xF6) | rangeMaskNEON(bytes, 0xF8, 0xFF)
+                | rangeMaskNEON(bytes, 0xAA, 0xAA) | rangeMaskNEON(bytes, 0xB5, 0xB5) | rangeMaskNEON(bytes, 0xBA, 0xBA)) << shift;
+            masks.space |= (rangeMaskNEON(bytes, 0x85, 0x85) | rangeMaskNEON(bytes, 0xA0, 0xA0)) << shift;
+        }
+        else
+        {
+            masks.continuation |= rangeMaskNEON(bytes, 0x80, 0xBF) << shift;
+            masks.fromE0 |= rangeMaskNEON(bytes, 0xE0, 0xFF) << shift;
+            masks.fromF0 |= rangeMaskNEON(bytes, 0xF0, 0xFF) << shift;
+            masks.letterLead |= (rangeMaskNEON(bytes, 0xC4, 0xCA) | rangeMaskNEON(bytes, 0xD0, 0xD1)
+                | rangeMaskNEON(bytes, 0xE5, 0xE9) | rangeMaskNEON(bytes, 0xEB, 0xEC)) << shift;
+            masks.leadC3 |= rangeMaskNEON(bytes, 0xC3, 0xC3) << shift;
+            masks.leadE4 |= rangeMaskNEON(bytes, 0xE4, 0xE4) << shift;
+            masks.byte97 |= rangeMaskNEON(bytes, 0x97, 0x97) << shift;
+            masks.byteB7 |= rangeMaskNEON(bytes, 0xB7, 0xB7) << shift;
+        }
+    }
+}
+
+template <unsigned Metrics = allMetrics, textEncoding Encoding = textEncoding::ascii>
+inline void countBytesNEON(const char* data, std::size_t size, scanState& state, counter& stats)
+{
+    const uint8x16_t newline = vdupq_n_u8('\n');
+    const uint8x16_t carriageReturn = vdupq_n_u8('\r');
+    const uint8x16_t space = vdupq_n_u8(' ');
+    const uint8x16_t tab = vdupq_n_u8('\t');
+    const uint8x16_t controls = vdupq_n_u8(5);
+    const uint8x16_t caseBit = vdupq_n_u8(0x20);
+    const uint8x16_t lowerA = vdupq_n_u8('a');
+    const uint8x16_t alphabet = vdupq_n_u8(26);
+    const uint8x16_t highBit = vdupq_n_u8(0x80);
+
+    std::size_t i = 0;
+    while (i + 64 <= size)
+    {
+        blockMasks masks;
+        for (int part = 0; part < 4; part++)
+        {
+            const uint8x16_t bytes = vld1q_u8(reinterpret_cast<const uint8_t*>(data + i + part * 16));
+            const int shift = part * 16;
+            if constexpr (needsLineMasks<Metrics>)
+            {
+                masks.newline |= neonMovemask(vceqq_u8(bytes, newline)) << shift;
+                masks.carriageReturn |= neonMovemask(vceqq_u8(bytes, carriageReturn)) << shift;
+            }
+            if constexpr (needsSpaceMask<Metrics>)
+                masks.space |= neonMovemask(vorrq_u8(vceqq_u8(bytes, space), vcltq_u8(vsubq_u8(bytes, tab), controls))) << shift;
+            if constexpr (needsLetterMask<Metrics>)
+            {
+                const uint8x16_t letter = vcltq_u8(vsubq_u8(vorrq_u8(bytes, caseBit), lowerA), alphabet);
+                masks.letter |= neonMovemask(letter) << shift;
+            }
+            if constexpr (needsHighMask<Metrics, Encoding>)
+                masks.high |= neonMovemask(vcgeq_u8(bytes, highBit)) << shift;
+        }
+        if constexpr (needsHighMask<Metrics, Encoding>)
+        {
+            if (masks.high != 0)
+                highMasksNEON<Encoding>(data + i, masks);
+        }
+        i += countBlock<Metrics, Encoding>(masks, data + i, state, stats);
+    }
+    countBytesScalar<Metrics, Encoding>(data + i, size - i, state, stats);
+}
+#endif
+
+using countKernel = void (*)(const char*, std::size_t, scanState&, counter&);
+
+// The kernels of one instruction set and encoding, one per metric set,
+// indexed by its bits; entry 0 is never used.
+using kernelTable = std::array<countKernel, allMetrics + 1>;
+
+// The kernels of one instruction set, indexed by encoding and metric set.
+using encodingKernels = std::array<kernelTable, textEncodings>;
+
+#define ASD_METRIC_KERNELS(kernel, encoding) kernelTable{ nullptr, kernel<1, encoding>, kernel<2, encoding>, kernel<3, encoding>, \
+    kernel<4, encoding>, kernel<5, encoding>, kernel<6, encoding>, kernel<7, encoding> }
+#define ASD_KERNEL_TABLE(kernel) encodingKernels{ ASD_METRIC_KERNELS(kernel, textEncoding::ascii), \
+    ASD_METRIC_KERNELS(kernel, textEncoding::latin1), ASD_METRIC_KERNELS(kernel, textEncoding::utf8) }
+
+struct countKernelInfo {
+    encodingKernels kernels;
+    const char* name;
+
+    countKernel kernel(unsigned metrics, textEncoding encoding) const
+    {
+        return kernels[static_cast<int>(encoding)][metrics];
+    }
+};
+
+// Picks the widest kernels the running CPU supports, once per process.
+inline const countKernelInfo& selectedCountKernel()
+{
+    static const countKernelInfo selected = []
+    {
+#ifdef ASD_SIMD_X86
+        if (cpuHasAVX2())
+            return countKernelInfo{ ASD_KERNEL_TABLE(countBytesAVX2), "AVX2" };
+        return countKernelInfo{ ASD_KERNEL_TABLE(countBytesSSE2), "SSE2" };
+#elif defined(ASD_SIMD_NEON)
+        return countKernelInfo{ ASD_KERNEL_TABLE(countBytesNEON), "NEON" };
+#else
+        return countKernelInfo{ ASD_KERNEL_TABLE(countBytesScalar), "scalar" };
+#endif
+    }();
+    return selected;
+}
+
+// Metric set and encoding countBytes counts with. Change them only while
+// nothing is counted.
+inline unsigned countedMetrics = allMetrics;
+inline textEncoding countedEncoding = textEncoding::ascii;
+
+// Counts the metrics of countedMetrics in one block of bytes.
+inline void countBytes(const char* data, std::size_t size, scanState& state, counter& stats)
+{
+    ASD_PROFILE_PHASE(profilePhase::count);
+    ASD_PROFILE_EVENT(profileEvent::bytesCounted, size);
+    selectedCountKernel().kernel(countedMetrics, countedEncoding)(data, size, state, stats);
+}
+
+// The state before data[offset] in countedEncoding.
+inline scanState stateBefore(const char* data, std::size_t offset)
+{
+    switch (countedEncoding)
+    {
+    case textEncoding::latin1:
+        return encodedStateBefore<textEncoding::latin1>(data, offset);
+    case textEncoding::utf8:
+        return encodedStateBefore<textEncoding::utf8>(data, offset);
+    default:
+        return encodedStateBefore<textEncoding::ascii>(data, offset);
+    }
+}
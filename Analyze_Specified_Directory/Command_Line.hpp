@@ -0,0 +1,722 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Async_Reader.hpp"
+#include "Distributed_Scan.hpp"
+#include "Result_Output.hpp"
+#include "Scan_Filter.hpp"
+#include "Synced_Stream.hpp"
+#include "Thread_Pool.hpp"
+#include "Tree_Generator.hpp"
+
+// Settings of one program run, filled from the command line.
+struct options {
+    std::vector<std::string> paths;
+    bool benchmark = false;
+    bool showHelp = false;
+    int threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    int discoveryThreads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    int queueLimit = 4096;
+    int maxQueuedTasks = 16384;
+    std::uint64_t maxInflightBytes = 0;
+    std::uint64_t maxOpenFiles = 0;
+    std::vector<int> threadList;
+    int repetitions = 1;
+    int warmups = 0;
+    bool coldCache = false;
+    outputMode listing = outputMode::buffered;
+    placementMode placement = placementMode::none;
+    schedulerMode scheduler = schedulerMode::workStealing;
+    std::size_t splitThreshold = 64ull << 20;
+    std::size_t splitChunkSize = 8ull << 20;
+    ioEngine engine = ioEngine::sync;
+    int ioDepth = 32;
+    std::string cachePath;
+    bool breakdown = false;
+    bool watch = false;
+    std::string statusPath;
+    std::string outputPath;
+    resultFormat outputFormat = resultFormat::jsonl;
+    bool profile = false;
+    std::string tracePath;
+    std::string generatePath;
+    treeSpec tree;
+    unsigned metrics = allMetrics;
+    textEncoding encoding = textEncoding::ascii;
+    scanFilter filter;
+    std::string servePort;
+    std::string bindAddress = "127.0.0.1";
+    std::vector<std::string> workers;
+    int shardDepth = 2;
+};
+
+inline void printUsage(const char* program)
+{
+    std::cout << "Usage: " << program << " [options] <path>...\n"
+        << "\n"
+        << "Without a path the program asks for one and benchmarks 1..N threads.\n"
+        << "\n"
+        << "Options:\n"
+        << "  -t, --threads <n>             analysis threads used for a single run (default: all hardware threads)\n"
+        << "  -d, --discovery-threads <n>   threads walking the directories (default: all hardware threads)\n"
+        << "      --queue-limit <n>         file jobs allowed to wait for analysis (default: 4096)\n"
+        << "      --max-queued <n>          directory tasks allowed to wait, then the walk goes depth first (default: 16384)\n"
+        << "      --max-inflight <size>     bytes of queued and counted files at once, with an optional K, M or G (default: no limit)\n"
+        << "      --max-open <n>            files open for counting at once (default: what the descriptor limit leaves)\n"
+        << "  -b, --benchmark               run the benchmark instead of a single run\n"
+        << "  -l, --thread-list <list>      thread counts to benchmark, e.g. 1,2,4,8 (default: 1..N)\n"
+        << "  -r, --repeat <n>              repetitions of every benchmarked thread count (default: 1)\n"
+        << "  -w, --warmup <n>              untimed runs before the benchmark starts (default: 0)\n"
+        << "  -c, --cold                    with -b, evict the scanned files from the page cache before every run\n"
+        << "      --listing <mode>          how found entries are listed: direct, buffered or quiet (default: buffered)\n"
+        << "  -q, --quiet                   don't list found entries, same as --listing quiet\n"
+        << "      --scheduler <mode>        task queues of the pools: shared, stealing or lockfree (default: stealing)\n"
+        << "      --affinity <mode>         where worker threads run: none, pin (one CPU each) or numa (default: none)\n"
+        << "      --split-above <MiB>       count files larger than this in parallel pieces (default: 64)\n"
+        << "      --split-chunk <MiB>       size of one piece of a split file (default: 8)\n"
+        << "      --io <engine>             how files are read: sync or async (io_uring / IOCP) (default: sync)\n"
+        << "      --io-depth <n>            reads kept in flight per analysis thread with --io async, at most 4096 (default: 32)\n"
+        << "      --cache <file>            reuse counts of unchanged files from this cache and update it\n"
+        << "      --breakdown               also report counts per extension and per top-level directory\n"
+        << "      --watch                   keep watching the paths after the scan and update the totals\n"
+        << "      --status <file>           with --watch, keep the current totals in this file\n"
+        << "      --metrics <list>          what to count: lines, words, letters or all, e.g. lines,words (default: all)\n"
+        << "      --encoding <name>         how words and letters are read: ascii, latin1 or utf8 (default: ascii)\n"
+        << "      --include <glob>          only count files matching this, e.g. *.cpp (repeatable)\n"
+        << "      --exclude <glob>          skip files and directories matching this, e.g. build/ (repeatable)\n"
+        << "      --ignore-file <file>      skip what the .gitignore-style rules of this file match\n"
+        << "      --gitignore               also follow the .gitignore files of the walked directories\n"
+        << "      --max-depth <n>           levels of subdirectories walked below a path (default: all)\n"
+        << "      --min-size <size>         skip files smaller than this, with an optional K, M or G\n"
+        << "      --max-size <size>         skip files larger than this, with an optional K, M or G\n"
+        << "      --skip-binary             skip files with a NUL byte in their first 4 KiB\n"
+        << "  -o, --output <file>           also write per-file records, totals and timings to this file\n"
+        << "      --format <format>         format of --output: jsonl, csv or binary (default: jsonl)\n"
+        << "      --profile                 report time per phase and event counters (needs ASD_PROFILING=1)\n"
+        << "      --trace <file>            write the profiled phases as a Chrome trace (needs ASD_PROFILING=1)\n"
+        << "      --generate <dir>          create a synthetic tree in this new directory, then analyze it\n"
+        << "      --tree-depth <n>          levels of subdirectories below the generated root (default: 3)\n"
+        << "      --tree-fanout <n>         subdirectories of every generated directory (default: 4)\n"
+        << "      --tree-files <n>          files in every generated directory (default: 16)\n"
+        << "      --file-size <dist>        fixed:<size>, uniform:<min>-<max> or lognormal:<median> (default: lognormal:4K)\n"
+        << "      --line-length <n>         average length of generated lines (default: 60)\n"
+        << "      --empty-lines <percent>   share of generated lines that are empty (default: 10)\n"
+        << "      --seed <n>                seed of the generated tree (default: 1)\n"
+        << "      --serve <port>            run as a worker of distributed scans of the given paths, taking jobs on this TCP port\n"
+        << "      --bind <address>          with --serve, the address to listen on, 0.0.0.0 or :: for all (default: 127.0.0.1)\n"
+        << "      --workers <list>          scan with the workers at these addresses, e.g. node1:7070,node2:7070\n"
+        << "      --shard-depth <n>         with --workers, levels always split into one job per directory (default: 2)\n"
+        << "  -h, --help                    show this help\n";
+}
+
+// Reads a positive number, returns false when the text is not one.
+inline bool parsePositive(const std::string& text, int& value)
+{
+    std::size_t used = 0;
+    try
+    {
+        value = std::stoi(text, &used);
+    }
+    catch (...)
+    {
+        return false;
+    }
+    return used == text.size() && value > 0;
+}
+
+// Reads a number that may be zero.
+inline bool parseUnsigned(const std::string& text, std::uint64_t& value)
+{
+    std::size_t used = 0;
+    try
+    {
+        value = std::stoull(text, &used);
+    }
+    catch (...)
+    {
+        return false;
+    }
+    return used == text.size() && text.find('-') == std::string::npos;
+}
+
+// Reads a size in bytes with an optional K, M or G suffix (powers of 1024).
+inline bool parseSize(std::string text, std::uint64_t& bytes)
+{
+    int shift = 0;
+    if (!text.empty())
+    {
+        switch (text.back())
+        {
+        case 'K': case 'k': shift = 10; break;
+        case 'M': case 'm': shift = 20; break;
+        case 'G': case 'g': shift = 30; break;
+        }
+        if (shift != 0)
+            text.pop_back();
+    }
+    if (!parseUnsigned(text, bytes) || bytes > (~std::uint64_t(0) >> shift))
+        return false;
+    bytes <<= shift;
+    return true;
+}
+
+// Reads a comma-separated list of lines, words, letters and all.
+inline bool parseMetrics(const std::string& text, unsigned& metrics)
+{
+    metrics = 0;
+    std::stringstream list(text);
+    std::string item;
+    while (std::getline(list, item, ','))
+    {
+        if (item == "lines")
+            metrics |= metricLines;
+        else if (item == "words")
+            metrics |= metricWords;
+        else if (item == "letters")
+            metrics |= metricLetters;
+        else if (item == "all")
+            metrics |= allMetrics;
+        else
+            return false;
+    }
+    return metrics != 0;
+}
+
+// Reads fixed:<size>, uniform:<min>-<max> or lognormal:<median>.
+inline bool parseSizeDistribution(const std::string& text, treeSpec& spec)
+{
+    const std::size_t colon = text.find(':');
+    if (colon == std::string::npos)
+        return false;
+    const std::string kind = text.substr(0, colon);
+    const std::string value = text.substr(colon + 1);
+    if (kind == "fixed" && parseSize(value, spec.size))
+    {
+        spec.distribution = sizeDistribution::fixed;
+        return true;
+    }
+    if (kind == "lognormal" && parseSize(value, spec.size) && spec.size > 0)
+    {
+        spec.distribution = sizeDistribution::lognormal;
+        return true;
+    }
+    const std::size_t dash = value.find('-');
+    if (kind == "uniform" && dash != std::string::npos && parseSize(value.substr(0, dash), spec.size)
+        && parseSize(value.substr(dash + 1), spec.maxSize) && spec.size <= spec.maxSize)
+    {
+        spec.distribution = sizeDistribution::uniform;
+        return true;
+    }
+    return false;
+}
+
+// Reads a comma separated list of positive numbers.
+inline bool parseThreadList(const std::string& text, std::vector<int>& list)
+{
+    std::stringstream items(text);
+    std::string item;
+    list.clear();
+    while (getline(items, item, ','))
+    {
+        int value = 0;
+        if (!parsePositive(item, value))
+            return false;
+        list.push_back(value);
+    }
+    return !list.empty();
+}
+
+// Reads a comma separated list of host:port addresses.
+inline bool parseWorkerList(const std::string& text, std::vector<std::string>& list)
+{
+    std::stringstream items(text);
+    std::string item;
+    list.clear();
+    while (getline(items, item, ','))
+    {
+        std::uint64_t port = 0;
+        const std::size_t colon = item.rfind(':');
+        if (colon == std::string::npos || colon == 0 || !parseUnsigned(item.substr(colon + 1), port) || port == 0 || port > 65535)
+            return false;
+        list.push_back(item);
+    }
+    return !list.empty();
+}
+
+// Fills settings from the arguments. On failure error describes the problem.
+inline bool parseArguments(int argc, char* argv[], options& settings, std::string& error)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string argument = argv[i];
+        const bool hasValue = i + 1 < argc;
+
+        if (argument == "-h" || argument == "--help")
+        {
+            settings.showHelp = true;
+        }
+        else if (argument == "-b" || argument == "--benchmark")
+        {
+            settings.benchmark = true;
+        }
+        else if (argument == "-t" || argument == "--threads")
+        {
+            if (!hasValue || !parsePositive(argv[++i], settings.threads))
+            {
+                error = "Expected a positive number of threads after " + argument + ".";
+                return false;
+            }
+        }
+        else if (argument == "-d" || argument == "--discovery-threads")
+        {
+            if (!hasValue || !parsePositive(argv[++i], settings.discoveryThreads))
+            {
+                error = "Expected a positive number of threads after " + argument + ".";
+                return false;
+            }
+        }
+        else if (argument == "--queue-limit")
+        {
+            if (!hasValue || !parsePositive(argv[++i], settings.queueLimit))
+            {
+                error = "Expected a positive number of file jobs after " + argument + ".";
+                return false;
+            }
+        }
+        else if (argument == "--max-queued")
+        {
+            if (!hasValue || !parsePositive(argv[++i], settings.maxQueuedTasks))
+            {
+                error = "Expected a positive number of tasks after " + argument + ".";
+                return false;
+            }
+        }
+        else if (argument == "--max-inflight")
+        {
+            if (!hasValue || !parseSize(argv[++i], settings.maxInflightBytes) || settings.maxInflightBytes == 0)
+            {
+                error = "Expected a size like 256M or 1G after " + argument + ".";
+                return false;
+            }
+        }
+        else if (argument == "--max-open")
+        {
+            if (!hasValue || !parseUnsigned(argv[++i], settings.maxOpenFiles) || settings.maxOpenFiles == 0)
+            {
+                error = "Expected a positive number of files after " + argument + ".";
+                return false;
+            }
+        }
+        else if (argument == "-l" || argument == "--thread-list")
+        {
+            if (!hasValue || !parseThreadList(argv[++i], settings.threadList))
+            {
+                error = "Expected a list of thread counts like 1,2,4,8 after " + argument + ".";
+                return false;
+            }
+        }
+        else if (argument == "-r" || argument == "--repeat")
+        {
+            if (!hasValue || !parsePositive(argv[++i], settings.repetitions))
+            {
+                error = "Expected a positive number of repetitions after " + argument + ".";
+                return false;
+            }
+        }
+        else if (argument == "-w" || argument == "--warmup")
+        {
+            std::uint64_t warmups = 0;
+            if (!hasValue || !parseUnsigned(argv[++i], warmups) || warmups > 1000000)
+            {
+                error = "Expected a number of warm-up runs after " + argument + ".";
+                return false;
+            }
+            settings.warmups = static_cast<int>(warmups);
+        }
+        else if (argument == "-c" || argument == "--cold")
+        {
+            settings.coldCache = true;
+        }
+        else if (argument == "--listing")
+        {
+            const std::string mode = hasValue ? argv[++i] : "";
+            if (mode == "direct")
+                settings.listing = outputMode::direct;
+            else if (mode == "buffered")
+                settings.listing = outputMode::buffered;
+            else if (mode == "quiet")
+                settings.listing = outputMode::quiet;
+            else
+            {
+                error = "Expected direct, buffered or quiet after " + argument + ".";
+                return false;
+            }
+        }
+        else if (argument == "--scheduler")
+        {
+            const std::string mode = hasValue ? argv[++i] : "";
+            if (mode == "shared")
+                settings.scheduler = schedulerMode::sharedQueue;
+            else if (mode == "stealing")
+                settings.scheduler = schedulerMode::workStealing;
+            else if (mode == "lockfree")
+                settings.scheduler = schedulerMode::lockFreeQueue;
+            else
+            {
+                error = "Expected shared, stealing or lockfree after " + argument + ".";
+                return false;
+            }
+        }
+        else if (argument == "--affinity")
+        {
+            const std::string mode = hasValue ? argv[++i] : "";
+            if (mode == "none")
+                settings.placement = placementMode::none;
+            else if (mode == "pin")
+                settings.placement = placementMode::pinned;
+            else if (mode == "numa")
+                settings.placement = placementMode::numa;
+            else
+            {
+                error = "Expected none, pin or numa after " + argument + ".";
+                return false;
+            }
+        }
+        else if (argument == "--split-above" || argument == "--split-chunk")
+        {
+            int mebibytes = 0;
+            if (!hasValue || !parsePositive(argv[++i], mebibytes))
+            {
+                error = "Expected a positive size in MiB after " + argument + ".";
+                return false;
+            }
+            const std::size_t bytes = static_cast<std::size_t>(mebibytes) << 20;
+            if (argument == "--split-above")
+                settings.splitThreshold = bytes;
+            else
+                settings.splitChunkSize = bytes;
+        }
+        else if (argument == "--io")
+        {
+            const std::string engine = hasValue ? argv[++i] : "";
+            if (engine == "sync")
+                settings.engine = ioEngine::sync;
+            else if (engine == "async")
+                settings.engine = ioEngine::async;
+            else
+            {
+                error = "Expected sync or async after " + argument + ".";
+                return false;
+            }
+        }
+        else if (argument == "--io-depth")
+        {
+            if (!hasValue || !parsePositive(argv[++i], settings.ioDepth) || settings.ioDepth > asyncReader::max_depth)
+            {
+                error = "Expected a number from 1 to " + std::to_string(asyncReader::max_depth) + " after " + argument + ".";
+                return false;
+            }
+        }
+        else if (argument == "--cache")
+        {
+            if (!hasValue)
+            {
+                error = "Expected a cache file after " + argument + ".";
+                return false;
+            }
+            settings.cachePath = argv[++i];
+        }
+        else if (argument == "--breakdown")
+        {
+            settings.breakdown = true;
+        }
+        else if (argument == "--watch")
+        {
+            settings.watch = true;
+        }
+        else if (argument == "--status")
+        {
+            if (!hasValue)
+            {
+                error = "Expected a status file after " + argument + ".";
+                return false;
+            }
+            settings.statusPath = argv[++i];
+        }
+        else if (argument == "--metrics")
+        {
+            if (!hasValue || !parseMetrics(argv[++i], settings.metrics))
+            {
+                error = "Expected a list of lines, words, letters or all after " + argument + ".";
+                return false;
+            }
+        }
+        else if (argument == "--encoding")
+        {
+            const std::string encoding = hasValue ? argv[++i] : "";
+            if (encoding == "ascii")
+                settings.encoding = textEncoding::ascii;
+            else if (encoding == "latin1")
+                settings.encoding = textEncoding::latin1;
+            else if (encoding == "utf8")
+                settings.encoding = textEncoding::utf8;
+            else
+            {
+                error = "Expected ascii, latin1 or utf8 after " + argument + ".";
+                return false;
+            }
+        }
+        else if (argument == "--include")
+        {
+            if (!hasValue)
+            {
+                error = "Expected a glob after " + argument + ".";
+                return false;
+            }
+            settings.filter.includes.push_back(argv[++i]);
+        }
+        else if (argument == "--exclude")
+        {
+            ignorePattern pattern;
+            if (!hasValue || !parseIgnoreLine(argv[++i], pattern))
+            {
+                error = "Expected a glob after " + argument + ".";
+                return false;
+            }
+            settings.filter.excludes.push_back(std::move(pattern));
+        }
+        else if (argument == "--ignore-file")
+        {
+            if (!hasValue)
+            {
+                error = "Expected a rule file after " + argument + ".";
+                return false;
+            }
+            const std::string path = argv[++i];
+            if (!loadIgnoreFile(path, settings.filter.excludes))
+            {
+                error = "Could not read the rule file " + path + ".";
+                return false;
+            }
+        }
+        else if (argument == "--gitignore")
+        {
+            settings.filter.gitignore = true;
+        }
+        else if (argument == "--max-depth")
+        {
+            std::uint64_t depth = 0;
+            if (!hasValue || !parseUnsigned(argv[++i], depth) || depth > 100000)
+            {
+                error = "Expected a number of levels after " + argument + ".";
+                return false;
+            }
+            settings.filter.maxDepth = static_cast<int>(depth);
+        }
+        else if (argument == "--min-size" || argument == "--max-size")
+        {
+            std::uint64_t bytes = 0;
+            if (!hasValue || !parseSize(argv[++i], bytes))
+            {
+                error = "Expected a size like 512, 64K or 2M after " + argument + ".";
+                return false;
+            }
+            if (argument == "--min-size")
+                settings.filter.minSize = bytes;
+            else
+                settings.filter.maxSize = bytes;
+        }
+        else if (argument == "--skip-binary")
+        {
+            settings.filter.skipBinary = true;
+        }
+        else if (argument == "-o" || argument == "--output")
+        {
+            if (!hasValue)
+            {
+                error = "Expected an output file after " + argument + ".";
+                return false;
+            }
+            settings.outputPath = argv[++i];
+        }
+        else if (argument == "--format")
+        {
+            const std::string format = hasValue ? argv[++i] : "";
+            if (format == "jsonl")
+                settings.outputFormat = resultFormat::jsonl;
+            else if (format == "csv")
+                settings.outputFormat = resultFormat::csv;
+            else if (format == "binary")
+                settings.outputFormat = resultFormat::binary;
+            else
+            {
+                error = "Expected jsonl, csv or binary after " + argument + ".";
+                return false;
+            }
+        }
+        else if (argument == "--profile")
+        {
+            settings.profile = true;
+        }
+        else if (argument == "--trace")
+        {
+            if (!hasValue)
+            {
+                error = "Expected a trace file after " + argument + ".";
+                return false;
+            }
+            settings.tracePath = argv[++i];
+        }
+        else if (argument == "--generate")
+        {
+            if (!hasValue)
+            {
+                error = "Expected a directory after " + argument + ".";
+                return false;
+            }
+            settings.generatePath = argv[++i];
+        }
+        else if (argument == "--tree-depth" || argument == "--tree-fanout" || argument == "--tree-files" || argument == "--line-length")
+        {
+            int value = 0;
+            if (!hasValue || !parsePositive(argv[++i], value))
+            {
+                error = "Expected a positive number after " + argument + ".";
+                return false;
+            }
+            if (argument == "--tree-depth")
+                settings.tree.depth = value;
+            else if (argument == "--tree-fanout")
+                settings.tree.fanout = value;
+            else if (argument == "--tree-files")
+                settings.tree.files = value;
+            else
+                settings.tree.lineLength = value;
+        }
+        else if (argument == "--file-size")
+        {
+            if (!hasValue || !parseSizeDistribution(argv[++i], settings.tree))
+            {
+                error = "Expected fixed:<size>, uniform:<min>-<max> or lognormal:<median> after " + argument + ".";
+                return false;
+            }
+        }
+        else if (argument == "--empty-lines")
+        {
+            std::uint64_t percent = 0;
+            if (!hasValue || !parseUnsigned(argv[++i], percent) || percent > 100)
+            {
+                error = "Expected a percentage from 0 to 100 after " + argument + ".";
+                return false;
+            }
+            settings.tree.emptyPercent = static_cast<int>(percent);
+        }
+        else if (argument == "--seed")
+        {
+            if (!hasValue || !parseUnsigned(argv[++i], settings.tree.seed))
+            {
+                error = "Expected a number after " + argument + ".";
+                return false;
+            }
+        }
+        else if (argument == "--serve")
+        {
+            std::uint64_t port = 0;
+            if (!hasValue || !parseUnsigned(argv[++i], port) || port == 0 || port > 65535)
+            {
+                error = "Expected a port from 1 to 65535 after " + argument + ".";
+                return false;
+            }
+            settings.servePort = argv[i];
+        }
+        else if (argument == "--bind")
+        {
+            if (!hasValue)
+            {
+                error = "Expected an address after " + argument + ".";
+                return false;
+            }
+            settings.bindAddress = argv[++i];
+        }
+        else if (argument == "--workers")
+        {
+            if (!hasValue || !parseWorkerList(argv[++i], settings.workers))
+            {
+                error = "Expected a list of host:port addresses after " + argument + ".";
+                return false;
+            }
+        }
+        else if (argument == "--shard-depth")
+        {
+            std::uint64_t depth = 0;
+            if (!hasValue || !parseUnsigned(argv[++i], depth) || depth > 1000)
+            {
+                error = "Expected a number of levels after " + argument + ".";
+                return false;
+            }
+            settings.shardDepth = static_cast<int>(depth);
+        }
+        else if (argument == "-q" || argument == "--quiet")
+        {
+            settings.listing = outputMode::quiet;
+        }
+        else if (argument.size() > 1 && argument[0] == '-')
+        {
+            error = "Unknown option " + argument + ".";
+            return false;
+        }
+        else
+        {
+            settings.paths.push_back(argument);
+        }
+    }
+    if (settings.watch && (settings.benchmark || (settings.paths.empty() && settings.generatePath.empty())))
+    {
+        error = "--watch needs at least one path and can't be combined with --benchmark.";
+        return false;
+    }
+    // Without a path the program benchmarks anyway.
+    if (settings.coldCache && !settings.benchmark && (!settings.paths.empty() || !settings.generatePath.empty()))
+    {
+        error = "--cold only applies to the runs of --benchmark.";
+        return false;
+    }
+    if (settings.metrics != allMetrics && (settings.watch || !settings.cachePath.empty()))
+    {
+        error = "--metrics can't be combined with --cache or --watch, they keep complete counts.";
+        return false;
+    }
+    if (settings.filter.active() && settings.watch)
+    {
+        error = "Filters can't be combined with --watch, which follows every file.";
+        return false;
+    }
+    if (settings.encoding != textEncoding::ascii && !settings.cachePath.empty())
+    {
+        error = "--encoding can't be combined with --cache, the cache keeps ASCII counts.";
+        return false;
+    }
+    // Workers count whole subtrees, which only the summary can report.
+    const bool needsLocalScan = settings.benchmark || settings.watch || !settings.cachePath.empty() || settings.breakdown
+        || settings.filter.active() || !settings.outputPath.empty();
+    // A worker only scans below the paths it was given.
+    if (!settings.servePort.empty() && (!settings.workers.empty() || settings.paths.empty() || !settings.generatePath.empty() || needsLocalScan))
+    {
+        error = "--serve needs the paths coordinators may scan and can't be combined with --workers, --generate, "
+            "--benchmark, --watch, --cache, --breakdown, filters or --output.";
+        return false;
+    }
+    if (!settings.workers.empty() && (needsLocalScan || (settings.paths.empty() && settings.generatePath.empty())))
+    {
+        error = "--workers needs at least one path and can't be combined with --benchmark, --watch, --cache, --breakdown, "
+            "filters or --output.";
+        return false;
+    }
+    return true;
+}
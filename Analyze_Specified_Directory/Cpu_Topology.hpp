@@ -0,0 +1,176 @@
+#pragma once
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+#endif
+
+// CPUs the process may run on, grouped by NUMA node. On Windows a CPU is
+// numbered group * 64 + its index in the processor group.
+struct cpuTopology {
+    std::vector<std::vector<int>> nodes;
+
+    std::vector<int> all_cpus() const
+    {
+        std::vector<int> cpus;
+        for (const auto& node : nodes)
+            cpus.insert(cpus.end(), node.begin(), node.end());
+        return cpus;
+    }
+};
+
+#ifdef __linux__
+// Parses a kernel CPU list such as "0-13,28-41".
+inline std::vector<int> parseCpuList(const std::string& text)
+{
+    std::vector<int> cpus;
+    std::stringstream list(text);
+    std::string range;
+    while (std::getline(list, range, ','))
+    {
+        int first = 0, last = 0;
+        const std::size_t dash = range.find('-');
+        try
+        {
+            first = std::stoi(range.substr(0, dash));
+            last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+        }
+        catch (...)
+        {
+            continue;
+        }
+        for (int cpu = first; cpu <= last; cpu++)
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+#endif
+
+inline cpuTopology detectTopology()
+{
+    cpuTopology topology;
+#ifdef _WIN32
+    DWORD length = 0;
+    GetLogicalProcessorInformationEx(RelationNumaNode, nullptr, &length);
+    std::vector<char> buffer(length);
+    if (length > 0 && GetLogicalProcessorInformationEx(RelationNumaNode,
+        reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(buffer.data()), &length))
+    {
+        for (DWORD offset = 0; offset < length;)
+        {
+            const auto* info = reinterpret_cast<const SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(buffer.data() + offset);
+            const GROUP_AFFINITY& mask = info->NumaNode.GroupMask;
+            std::vector<int> cpus;
+            for (int bit = 0; bit < 64; bit++)
+            {
+                if (mask.Mask & (KAFFINITY(1) << bit))
+                    cpus.push_back(mask.Group * 64 + bit);
+            }
+            if (!cpus.empty())
+                topology.nodes.push_back(cpus);
+            offset += info->Size;
+        }
+    }
+#elif defined(__linux__)
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    const bool restricted = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+    auto usable = [&](int cpu) { return !restricted || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)); };
+
+    if (DIR* directory = opendir("/sys/devices/system/node"))
+    {
+        std::vector<int> nodeNumbers;
+        while (const dirent* entry = readdir(directory))
+        {
+            const std::string name = entry->d_name;
+            if (name.size() > 4 && name.compare(0, 4, "node") == 0 && name.find_first_not_of("0123456789", 4) == std::string::npos)
+                nodeNumbers.push_back(std::stoi(name.substr(4)));
+        }
+        closedir(directory);
+        std::sort(nodeNumbers.begin(), nodeNumbers.end());
+        for (int node : nodeNumbers)
+        {
+            std::ifstream list("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+            std::string text;
+            std::getline(list, text);
+            std::vector<int> cpus;
+            for (int cpu : parseCpuList(text))
+            {
+                if (usable(cpu))
+                    cpus.push_back(cpu);
+            }
+            if (!cpus.empty())
+                topology.nodes.push_back(cpus);
+        }
+    }
+    if (topology.nodes.empty() && restricted)
+    {
+        std::vector<int> cpus;
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            if (CPU_ISSET(cpu, &allowed))
+                cpus.push_back(cpu);
+        }
+        topology.nodes.push_back(cpus);
+    }
+#endif
+    if (topology.nodes.empty())
+    {
+        std::vector<int> cpus;
+        for (int cpu = 0; cpu < static_cast<int>(std::max(1u, std::thread::hardware_concurrency())); cpu++)
+            cpus.push_back(cpu);
+        topology.nodes.push_back(cpus);
+    }
+    return topology;
+}
+
+inline const cpuTopology& systemTopology()
+{
+    static const cpuTopology topology = detectTopology();
+    return topology;
+}
+
+// Restricts the calling thread to the given CPUs. On Windows all of them
+// have to be in the processor group of the first one. Does nothing on
+// platforms without thread affinity.
+inline bool pinCurrentThread(const std::vector<int>& cpus)
+{
+    if (cpus.empty())
+        return false;
+#ifdef _WIN32
+    GROUP_AFFINITY affinity = {};
+    affinity.Group = static_cast<WORD>(cpus.front() / 64);
+    for (int cpu : cpus)
+    {
+        if (cpu / 64 == affinity.Group)
+            affinity.Mask |= KAFFINITY(1) << (cpu % 64);
+    }
+    return SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr) != 0;
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus)
+    {
+        if (cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,165 @@
+#pragma once
+#include <cerrno>
+#include <cstdint>
+#include <filesystem>
+#include <limits>
+#include <memory>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+enum class entryType
+{
+    file,
+    directory,
+    other
+};
+
+// Size reported when the enumeration doesn't provide it for free.
+constexpr std::uintmax_t unknownSize = std::numeric_limits<std::uintmax_t>::max();
+
+// One entry of a directory, as delivered by the platform enumeration.
+struct directoryEntry {
+    const char* name;
+    entryType type;
+    std::uintmax_t size;
+};
+
+// Appends name to the directory path with a single separator.
+inline std::string joinPath(const std::string& directory, const char* name)
+{
+    std::string path;
+    path.reserve(directory.size() + 1 + std::char_traits<char>::length(name));
+    path = directory;
+    if (!path.empty() && path.back() != '/' && path.back() != '\\')
+        path += '/';
+    path += name;
+    return path;
+}
+
+#ifndef _WIN32
+// Resolves entries whose type the directory doesn't store, following
+// symbolic links like std::filesystem::is_regular_file does.
+inline entryType statEntryType(int directoryFd, const char* name)
+{
+    struct stat info;
+    if (fstatat(directoryFd, name, &info, 0) != 0)
+        return entryType::other;
+    if (S_ISREG(info.st_mode))
+        return entryType::file;
+    if (S_ISDIR(info.st_mode))
+        return entryType::directory;
+    return entryType::other;
+}
+
+inline entryType typeFromDirent(unsigned char type, int directoryFd, const char* name)
+{
+    switch (type)
+    {
+    case DT_REG:
+        return entryType::file;
+    case DT_DIR:
+        return entryType::directory;
+    case DT_LNK:
+    case DT_UNKNOWN:
+        return statEntryType(directoryFd, name);
+    default:
+        return entryType::other;
+    }
+}
+#endif
+
+// Calls visit(const directoryEntry&) for every entry of the directory except
+// "." and "..". Types come straight from the directory data (getdents64 on
+// Linux, FindFirstFileExW on Windows), so regular entries cost no stat call.
+// Returns false when the directory can't be opened or reading it stops on an
+// error, in which case visit may have seen only part of the entries.
+template <typename F>
+bool enumerateDirectory(const std::string& path, F&& visit)
+{
+#ifdef _WIN32
+    const std::wstring pattern = std::filesystem::path(joinPath(path, "*")).wstring();
+    WIN32_FIND_DATAW data;
+    HANDLE find = FindFirstFileExW(pattern.c_str(), FindExInfoBasic, &data, FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH);
+    if (find == INVALID_HANDLE_VALUE)
+        return false;
+    do
+    {
+        const wchar_t* wideName = data.cFileName;
+        if (wideName[0] == L'.' && (wideName[1] == 0 || (wideName[1] == L'.' && wideName[2] == 0)))
+            continue;
+        const std::string name = std::filesystem::path(wideName).string();
+        const bool isDirectory = data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY;
+        const std::uintmax_t size = (std::uintmax_t(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+        visit(directoryEntry{ name.c_str(), isDirectory ? entryType::directory : entryType::file, isDirectory ? 0 : size });
+    } while (FindNextFileW(find, &data));
+    const bool complete = GetLastError() == ERROR_NO_MORE_FILES;
+    FindClose(find);
+    return complete;
+#elif defined(__linux__)
+    struct linuxDirent64 {
+        std::uint64_t d_ino;
+        std::int64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[1];
+    };
+    constexpr std::size_t bufferSize = 64 * 1024;
+
+    const int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    thread_local std::unique_ptr<char[]> buffer(new char[bufferSize]);
+    long got = 0;
+    while (true)
+    {
+        got = syscall(SYS_getdents64, fd, buffer.get(), bufferSize);
+        if (got <= 0)
+            break;
+        for (long offset = 0; offset < got;)
+        {
+            const auto* dirent = reinterpret_cast<const linuxDirent64*>(buffer.get() + offset);
+            offset += dirent->d_reclen;
+            const char* name = dirent->d_name;
+            if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0)))
+                continue;
+            visit(directoryEntry{ name, typeFromDirent(dirent->d_type, fd, name), unknownSize });
+        }
+    }
+    close(fd);
+    return got == 0;
+#else
+    DIR* directory = opendir(path.c_str());
+    if (directory == nullptr)
+        return false;
+    errno = 0;
+    while (const dirent* entry = readdir(directory))
+    {
+        const char* name = entry->d_name;
+        if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0)))
+            continue;
+        visit(directoryEntry{ name, typeFromDirent(entry->d_type, dirfd(directory), name), unknownSize });
+        errno = 0;
+    }
+    const bool complete = errno == 0;
+    closedir(directory);
+    return complete;
+#endif
+}
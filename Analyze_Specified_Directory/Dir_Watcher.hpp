@@ -0,0 +1,286 @@
+#pragma once
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include "Dir_Enumerator.hpp"
+
+enum class changeKind
+{
+    // The path was written, created or moved in.
+    modified,
+    // The path was deleted or moved away.
+    removed,
+    // Events were lost, everything has to be scanned again.
+    overflow
+};
+
+struct pathChange {
+    std::string path;
+    changeKind kind;
+};
+
+// Adds a change to a batch unless the latest change of the same path is of
+// the same kind, so a stream of writes to one file costs one re-count a
+// batch. A removal followed by a new entry under the name stays two changes.
+inline void addChange(std::vector<pathChange>& changes, std::unordered_map<std::string, std::size_t>& positions,
+    std::string path, changeKind kind)
+{
+    const auto latest = positions.find(path);
+    if (latest != positions.end() && changes[latest->second].kind == kind)
+        return;
+    positions[path] = changes.size();
+    changes.push_back(pathChange{ std::move(path), kind });
+}
+
+// Reports changes below the watched roots: inotify on Linux, where every
+// directory needs its own watch, and ReadDirectoryChangesW on Windows,
+// which watches a whole subtree at once.
+class directoryWatcher
+{
+public:
+
+    directoryWatcher();
+
+    ~directoryWatcher();
+
+    directoryWatcher(const directoryWatcher&) = delete;
+    directoryWatcher& operator=(const directoryWatcher&) = delete;
+
+    // Starts watching the tree below root.
+    bool add_root(const std::string& root);
+
+    // Starts watching one directory below a root. Only needed on Linux.
+    void add_directory(const std::string& path);
+
+    // Waits up to timeoutMs for changes and returns them, possibly none.
+    std::vector<pathChange> wait_for_changes(int timeoutMs);
+
+private:
+
+#ifdef _WIN32
+    struct rootWatch {
+        std::string path;
+        HANDLE directory = INVALID_HANDLE_VALUE;
+        OVERLAPPED overlapped = {};
+        alignas(DWORD) char buffer[64 * 1024];
+    };
+
+    bool arm(rootWatch& watch);
+
+    std::vector<std::unique_ptr<rootWatch>> roots;
+#else
+    // Drops the watches of path and everything below it, whose paths are
+    // no longer valid once the directory moved.
+    void forget_subtree(const std::string& path);
+
+    int inotify_fd = -1;
+    std::unordered_map<int, std::string> watched;
+#endif
+};
+
+#ifdef _WIN32
+directoryWatcher::directoryWatcher()
+{
+}
+
+directoryWatcher::~directoryWatcher()
+{
+    for (auto& watch : roots)
+    {
+        CancelIoEx(watch->directory, &watch->overlapped);
+        CloseHandle(watch->directory);
+        CloseHandle(watch->overlapped.hEvent);
+    }
+}
+
+bool directoryWatcher::arm(rootWatch& watch)
+{
+    const DWORD filter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME
+        | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE;
+    return ReadDirectoryChangesW(watch.directory, watch.buffer, sizeof(watch.buffer), TRUE, filter,
+        nullptr, &watch.overlapped, nullptr);
+}
+
+bool directoryWatcher::add_root(const std::string& root)
+{
+    auto watch = std::make_unique<rootWatch>();
+    watch->path = root;
+    watch->directory = CreateFileW(std::filesystem::path(root).c_str(), FILE_LIST_DIRECTORY,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+        FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+    if (watch->directory == INVALID_HANDLE_VALUE)
+        return false;
+    watch->overlapped.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    if (!arm(*watch))
+    {
+        CloseHandle(watch->directory);
+        CloseHandle(watch->overlapped.hEvent);
+        return false;
+    }
+    roots.push_back(std::move(watch));
+    return true;
+}
+
+void directoryWatcher::add_directory(const std::string&)
+{
+}
+
+std::vector<pathChange> directoryWatcher::wait_for_changes(int timeoutMs)
+{
+    std::vector<pathChange> changes;
+    std::unordered_map<std::string, std::size_t> positions;
+    std::vector<HANDLE> events;
+    for (auto& watch : roots)
+        events.push_back(watch->overlapped.hEvent);
+    if (events.empty() || WaitForMultipleObjects(static_cast<DWORD>(events.size()), events.data(), FALSE, timeoutMs) == WAIT_TIMEOUT)
+        return changes;
+
+    for (auto& watch : roots)
+    {
+        DWORD bytes = 0;
+        if (!GetOverlappedResult(watch->directory, &watch->overlapped, &bytes, FALSE))
+            continue;
+        ResetEvent(watch->overlapped.hEvent);
+        if (bytes == 0)
+        {
+            // The buffer overflowed and the system dropped the events.
+            changes.push_back(pathChange{ watch->path, changeKind::overflow });
+        }
+        for (DWORD offset = 0; bytes > 0;)
+        {
+            const auto* info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(watch->buffer + offset);
+            const std::wstring name(info->FileName, info->FileNameLength / sizeof(wchar_t));
+            const std::string path = joinPath(watch->path, std::filesystem::path(name).generic_string().c_str());
+            const bool removed = info->Action == FILE_ACTION_REMOVED || info->Action == FILE_ACTION_RENAMED_OLD_NAME;
+            addChange(changes, positions, path, removed ? changeKind::removed : changeKind::modified);
+            if (info->NextEntryOffset == 0)
+                break;
+            offset += info->NextEntryOffset;
+        }
+        arm(*watch);
+    }
+    return changes;
+}
+#else
+directoryWatcher::directoryWatcher()
+    : inotify_fd(inotify_init1(IN_CLOEXEC | IN_NONBLOCK))
+{
+}
+
+directoryWatcher::~directoryWatcher()
+{
+    if (inotify_fd >= 0)
+        close(inotify_fd);
+}
+
+bool directoryWatcher::add_root(const std::string& root)
+{
+    if (inotify_fd < 0)
+        return false;
+    add_directory(root);
+    return true;
+}
+
+void directoryWatcher::add_directory(const std::string& path)
+{
+    // IN_MODIFY catches files written by a writer that keeps them open.
+    const uint32_t mask = IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO
+        | IN_MOVE_SELF | IN_ONLYDIR;
+    const int wd = inotify_add_watch(inotify_fd, path.c_str(), mask);
+    if (wd >= 0)
+        watched[wd] = path;
+}
+
+void directoryWatcher::forget_subtree(const std::string& path)
+{
+    const std::string prefix = path + '/';
+    for (auto watch = watched.begin(); watch != watched.end();)
+    {
+        if (watch->second == path || watch->second.compare(0, prefix.size(), prefix) == 0)
+        {
+            inotify_rm_watch(inotify_fd, watch->first);
+            watch = watched.erase(watch);
+        }
+        else
+        {
+            ++watch;
+        }
+    }
+}
+
+std::vector<pathChange> directoryWatcher::wait_for_changes(int timeoutMs)
+{
+    std::vector<pathChange> changes;
+    std::unordered_map<std::string, std::size_t> positions;
+    pollfd waiting{ inotify_fd, POLLIN, 0 };
+    if (poll(&waiting, 1, timeoutMs) <= 0)
+        return changes;
+
+    alignas(inotify_event) char buffer[64 * 1024];
+    while (true)
+    {
+        const ssize_t got = read(inotify_fd, buffer, sizeof(buffer));
+        if (got <= 0)
+            break;
+        for (ssize_t offset = 0; offset < got;)
+        {
+            const auto* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+            offset += sizeof(inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                addChange(changes, positions, "", changeKind::overflow);
+                continue;
+            }
+            if (event->mask & IN_IGNORED)
+            {
+                watched.erase(event->wd);
+                continue;
+            }
+            const auto directory = watched.find(event->wd);
+            if (directory == watched.end())
+                continue;
+            // A watched directory moved without its parent's watch seeing
+            // it, like a root: it is gone from where it was watched.
+            if (event->mask & IN_MOVE_SELF)
+            {
+                const std::string moved = directory->second;
+                forget_subtree(moved);
+                addChange(changes, positions, moved, changeKind::removed);
+                continue;
+            }
+            if (event->len == 0)
+                continue;
+
+            // Files created by link() or mknod() are never closed after
+            // writing, so creations count as changes too.
+            std::string path = joinPath(directory->second, event->name);
+            const bool removed = event->mask & (IN_DELETE | IN_MOVED_FROM);
+            // A directory moved away takes its watches along, and their
+            // events would come under the old path. Where it went, if still
+            // below a root, it is watched anew like a new directory.
+            if ((event->mask & IN_MOVED_FROM) && (event->mask & IN_ISDIR))
+                forget_subtree(path);
+            addChange(changes, positions, std::move(path), removed ? changeKind::removed : changeKind::modified);
+        }
+    }
+    return changes;
+}
+#endif
@@ -0,0 +1,848 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "Ws2_32.lib")
+#endif
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "Dir_Enumerator.hpp"
+#include "Stats_Counter.hpp"
+#include "Text_Encoding.hpp"
+
+// Distributed scans: a coordinator hands subtrees of the scanned paths to
+// worker processes on other machines, which must see the same paths, and
+// merges the counts they send back. Messages are frames of a 4-byte length
+// and a payload of LEB128 numbers and length-prefixed strings, so a result
+// costs a few dozen bytes whatever the size of the subtree.
+
+#ifdef _WIN32
+using socketHandle = SOCKET;
+constexpr socketHandle noSocket = INVALID_SOCKET;
+#else
+using socketHandle = int;
+constexpr socketHandle noSocket = -1;
+#endif
+
+inline void closeSocket(socketHandle handle)
+{
+#ifdef _WIN32
+    closesocket(handle);
+#else
+    close(handle);
+#endif
+}
+
+// Winsock has to be started once per process.
+inline bool startSockets()
+{
+#ifdef _WIN32
+    static const bool started = []
+    {
+        WSADATA data;
+        return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+    }();
+    return started;
+#else
+    return true;
+#endif
+}
+
+// Largest frame sent or accepted, far above any real message.
+constexpr std::uint32_t maxFrameSize = 64u << 20;
+
+// A worker running a job sends a progress frame this often, and a side
+// that hears nothing for silenceTimeout takes the other one for lost, so a
+// hung worker or a peer gone without closing the connection can't stall a
+// scan, however long a job legitimately runs.
+constexpr std::chrono::milliseconds heartbeatInterval{ 1000 };
+constexpr std::chrono::milliseconds silenceTimeout{ 10000 };
+
+// Bytes of directory paths one result may send back, with room to spare
+// for the counts; a worker scans what doesn't fit itself.
+constexpr std::size_t maxReturnedBytes = maxFrameSize / 2;
+
+// One TCP connection exchanging whole frames.
+class netConnection
+{
+public:
+
+    netConnection() = default;
+
+    explicit netConnection(socketHandle _handle)
+        : handle(_handle)
+    {
+        no_delay();
+    }
+
+    ~netConnection()
+    {
+        close();
+    }
+
+    netConnection(const netConnection&) = delete;
+    netConnection& operator=(const netConnection&) = delete;
+
+    // Connects to host:port, trying every address the name resolves to.
+    bool connect_to(const std::string& host, const std::string& port)
+    {
+        close();
+        if (!startSockets())
+            return false;
+        addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* found = nullptr;
+        if (getaddrinfo(host.c_str(), port.c_str(), &hints, &found) != 0)
+            return false;
+        for (addrinfo* address = found; address != nullptr && handle == noSocket; address = address->ai_next)
+        {
+            handle = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+            if (handle != noSocket && connect(handle, address->ai_addr, static_cast<int>(address->ai_addrlen)) != 0)
+            {
+                closeSocket(handle);
+                handle = noSocket;
+            }
+        }
+        freeaddrinfo(found);
+        no_delay();
+        return handle != noSocket;
+    }
+
+    bool is_open() const
+    {
+        return handle != noSocket;
+    }
+
+    // Makes receiving and sending fail after the timeouts without progress,
+    // zero for waiting as long as it takes.
+    void set_timeouts(std::chrono::milliseconds receive, std::chrono::milliseconds send)
+    {
+        set_timeout(SO_RCVTIMEO, receive);
+        set_timeout(SO_SNDTIMEO, send);
+    }
+
+    // Lets the system notice a peer that vanished while the connection is
+    // idle, within about a minute where the probes can be tuned.
+    void keep_alive()
+    {
+        int enabled = 1;
+        setsockopt(handle, SOL_SOCKET, SO_KEEPALIVE, reinterpret_cast<const char*>(&enabled), sizeof(enabled));
+#ifdef TCP_KEEPIDLE
+        int idle = 30;
+        int interval = 10;
+        int probes = 3;
+        setsockopt(handle, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+        setsockopt(handle, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+        setsockopt(handle, IPPROTO_TCP, TCP_KEEPCNT, &probes, sizeof(probes));
+#endif
+    }
+
+    void close()
+    {
+        if (handle != noSocket)
+            closeSocket(handle);
+        handle = noSocket;
+    }
+
+    bool send_frame(std::string_view payload)
+    {
+        if (payload.size() > maxFrameSize)
+            return false;
+        char length[4];
+        const std::uint32_t size = static_cast<std::uint32_t>(payload.size());
+        for (int i = 0; i < 4; i++)
+            length[i] = static_cast<char>(size >> (8 * i));
+        return send_all(length, 4) && send_all(payload.data(), payload.size());
+    }
+
+    // False when the connection closed or sent something malformed.
+    bool receive_frame(std::string& payload)
+    {
+        unsigned char length[4];
+        if (!receive_all(reinterpret_cast<char*>(length), 4))
+            return false;
+        const std::uint32_t size = length[0] | (length[1] << 8) | (length[2] << 16) | (std::uint32_t(length[3]) << 24);
+        if (size > maxFrameSize)
+            return false;
+        payload.resize(size);
+        return receive_all(payload.data(), size);
+    }
+
+private:
+
+    void set_timeout(int option, std::chrono::milliseconds timeout)
+    {
+#ifdef _WIN32
+        const DWORD value = static_cast<DWORD>(timeout.count());
+#else
+        timeval value{};
+        value.tv_sec = static_cast<decltype(value.tv_sec)>(timeout.count() / 1000);
+        value.tv_usec = static_cast<decltype(value.tv_usec)>(timeout.count() % 1000 * 1000);
+#endif
+        setsockopt(handle, SOL_SOCKET, option, reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    // Frames are small and answered right away, Nagle would only delay them.
+    void no_delay()
+    {
+        if (handle == noSocket)
+            return;
+        int enabled = 1;
+        setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&enabled), sizeof(enabled));
+    }
+
+    bool send_all(const char* data, std::size_t size)
+    {
+#ifdef MSG_NOSIGNAL
+        constexpr int flags = MSG_NOSIGNAL;
+#else
+        constexpr int flags = 0;
+#endif
+        while (size > 0)
+        {
+            const int chunk = static_cast<int>(std::min<std::size_t>(size, 1 << 30));
+            const auto sent = send(handle, data, chunk, flags);
+            if (sent <= 0)
+                return false;
+            data += sent;
+            size -= static_cast<std::size_t>(sent);
+        }
+        return true;
+    }
+
+    bool receive_all(char* data, std::size_t size)
+    {
+        while (size > 0)
+        {
+            const int chunk = static_cast<int>(std::min<std::size_t>(size, 1 << 30));
+            const auto got = recv(handle, data, chunk, 0);
+            if (got <= 0)
+                return false;
+            data += got;
+            size -= static_cast<std::size_t>(got);
+        }
+        return true;
+    }
+
+    socketHandle handle = noSocket;
+};
+
+// Accepts the connections of coordinators.
+class netListener
+{
+public:
+
+    ~netListener()
+    {
+        if (handle != noSocket)
+            closeSocket(handle);
+    }
+
+    // Listens on the addresses host resolves to; "0.0.0.0" or "::" are
+    // every address of the machine.
+    bool listen_on(const std::string& host, const std::string& port)
+    {
+        if (!startSockets())
+            return false;
+        addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        addrinfo* found = nullptr;
+        if (getaddrinfo(host.c_str(), port.c_str(), &hints, &found) != 0)
+            return false;
+        // IPv6 first where it also accepts IPv4.
+        for (int family : { AF_INET6, AF_INET })
+        {
+            for (addrinfo* address = found; address != nullptr && handle == noSocket; address = address->ai_next)
+            {
+                if (address->ai_family != family)
+                    continue;
+                handle = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+                if (handle == noSocket)
+                    continue;
+                int enabled = 1;
+                int disabled = 0;
+                setsockopt(handle, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&enabled), sizeof(enabled));
+                if (family == AF_INET6)
+                    setsockopt(handle, IPPROTO_IPV6, IPV6_V6ONLY, reinterpret_cast<const char*>(&disabled), sizeof(disabled));
+                if (bind(handle, address->ai_addr, static_cast<int>(address->ai_addrlen)) != 0 || listen(handle, 16) != 0)
+                {
+                    closeSocket(handle);
+                    handle = noSocket;
+                }
+            }
+        }
+        freeaddrinfo(found);
+        return handle != noSocket;
+    }
+
+    socketHandle accept_connection()
+    {
+        return accept(handle, nullptr, nullptr);
+    }
+
+private:
+
+    socketHandle handle = noSocket;
+};
+
+// Builds a message payload.
+class wireWriter
+{
+public:
+
+    explicit wireWriter(std::uint8_t type)
+    {
+        bytes.push_back(static_cast<char>(type));
+    }
+
+    wireWriter& number(std::uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            bytes.push_back(static_cast<char>(value | 0x80));
+            value >>= 7;
+        }
+        bytes.push_back(static_cast<char>(value));
+        return *this;
+    }
+
+    wireWriter& text(std::string_view value)
+    {
+        number(value.size());
+        bytes += value;
+        return *this;
+    }
+
+    const std::string& payload() const
+    {
+        return bytes;
+    }
+
+private:
+
+    std::string bytes;
+};
+
+// Reads a message payload; once anything is missing every read fails.
+class wireReader
+{
+public:
+
+    explicit wireReader(std::string_view _bytes)
+        : bytes(_bytes) {}
+
+    std::uint8_t type()
+    {
+        std::uint64_t value = 0;
+        if (position < bytes.size())
+            value = static_cast<unsigned char>(bytes[position++]);
+        else
+            failed = true;
+        return static_cast<std::uint8_t>(value);
+    }
+
+    std::uint64_t number()
+    {
+        std::uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+            if (position == bytes.size())
+                break;
+            const unsigned char byte = static_cast<unsigned char>(bytes[position++]);
+            value |= std::uint64_t(byte & 0x7F) << shift;
+            if (byte < 0x80)
+                return value;
+        }
+        failed = true;
+        return 0;
+    }
+
+    std::string text()
+    {
+        const std::uint64_t size = number();
+        if (failed || size > bytes.size() - position)
+        {
+            failed = true;
+            return {};
+        }
+        std::string value(bytes.substr(position, static_cast<std::size_t>(size)));
+        position += static_cast<std::size_t>(size);
+        return value;
+    }
+
+    bool ok() const
+    {
+        return !failed;
+    }
+
+private:
+
+    std::string_view bytes;
+    std::size_t position = 0;
+    bool failed = false;
+};
+
+constexpr std::uint64_t wireMagic = 0x57445341; // "ASDW"
+constexpr std::uint64_t wireVersion = 3;
+
+enum wireMessage : std::uint8_t
+{
+    // Coordinator to worker: magic and version. The worker answers with
+    // its own and its number of analysis threads.
+    hello_message = 1,
+    // Coordinator to worker: id, kind, metric set, encoding, time slice in
+    // milliseconds and path.
+    job_message = 2,
+    // Worker to coordinator: id, whether the path could be listed, the six
+    // counts and the paths below the job's one that are left as new jobs.
+    result_message = 3,
+    // Worker to coordinator while a job runs: its id.
+    progress_message = 4
+};
+
+enum class scanKind : std::uint8_t
+{
+    // Everything below the directory, unless the walk outlasts the time
+    // slice of the job: from then on the subdirectories not walked yet are
+    // counted and sent back as new jobs, so the coordinator can spread a
+    // subtree that turned out large over the other workers.
+    tree,
+    // Only the files directly in the directory; its subdirectories are
+    // counted and sent back as new jobs.
+    level
+};
+
+struct scanRequest {
+    std::uint64_t id = 0;
+    scanKind kind = scanKind::tree;
+    unsigned metrics = allMetrics;
+    textEncoding encoding = textEncoding::ascii;
+    // Zero for no limit.
+    std::uint64_t sliceMilliseconds = 0;
+    std::string path;
+};
+
+struct scanResult {
+    std::uint64_t id = 0;
+    bool opened = false;
+    counter stats;
+    std::vector<std::string> subdirectories;
+};
+
+inline std::string encodeRequest(const scanRequest& request)
+{
+    wireWriter out(job_message);
+    out.number(request.id).number(static_cast<std::uint64_t>(request.kind)).number(request.metrics)
+        .number(static_cast<std::uint64_t>(request.encoding)).number(request.sliceMilliseconds).text(request.path);
+    return out.payload();
+}
+
+inline bool decodeRequest(std::string_view payload, scanRequest& request)
+{
+    wireReader in(payload);
+    if (in.type() != job_message)
+        return false;
+    request.id = in.number();
+    const std::uint64_t kind = in.number();
+    request.metrics = static_cast<unsigned>(in.number());
+    const std::uint64_t encoding = in.number();
+    request.sliceMilliseconds = in.number();
+    request.path = in.text();
+    if (!in.ok() || kind > 1 || encoding >= textEncodings || request.metrics == 0 || request.metrics > allMetrics)
+        return false;
+    request.kind = static_cast<scanKind>(kind);
+    request.encoding = static_cast<textEncoding>(encoding);
+    return true;
+}
+
+inline std::string encodeResult(const scanResult& result)
+{
+    wireWriter out(result_message);
+    const counter& stats = result.stats;
+    out.number(result.id).number(result.opened ? 1 : 0)
+        .number(static_cast<std::uint64_t>(stats.howManyDirectories)).number(static_cast<std::uint64_t>(stats.howManyFiles))
+        .number(static_cast<std::uint64_t>(stats.nonEmptyLines)).number(static_cast<std::uint64_t>(stats.emptyLines))
+        .number(static_cast<std::uint64_t>(stats.numWords)).number(static_cast<std::uint64_t>(stats.letters))
+        .number(result.subdirectories.size());
+    for (const auto& name : result.subdirectories)
+        out.text(name);
+    return out.payload();
+}
+
+inline bool decodeResult(std::string_view payload, scanResult& result)
+{
+    wireReader in(payload);
+    if (in.type() != result_message)
+        return false;
+    result.id = in.number();
+    result.opened = in.number() != 0;
+    std::int64_t* counts[] = { &result.stats.howManyDirectories, &result.stats.howManyFiles, &result.stats.nonEmptyLines,
+        &result.stats.emptyLines, &result.stats.numWords, &result.stats.letters };
+    for (std::int64_t* count : counts)
+        *count = static_cast<std::int64_t>(in.number());
+    const std::uint64_t names = in.number();
+    result.subdirectories.clear();
+    for (std::uint64_t i = 0; i < names && in.ok(); i++)
+        result.subdirectories.push_back(in.text());
+    return in.ok();
+}
+
+// Checks the hello of the other side.
+inline bool readHello(std::string_view payload, std::uint64_t& threads)
+{
+    wireReader in(payload);
+    const bool valid = in.type() == hello_message && in.number() == wireMagic && in.number() == wireVersion;
+    threads = in.number();
+    return valid && in.ok();
+}
+
+inline std::string helloPayload(std::uint64_t threads)
+{
+    wireWriter out(hello_message);
+    out.number(wireMagic).number(wireVersion).number(threads);
+    return out.payload();
+}
+
+// The absolute form of path with "." and ".." taken out.
+inline std::filesystem::path normalPath(const std::string& path)
+{
+    std::error_code error;
+    const std::filesystem::path absolute = std::filesystem::absolute(path, error);
+    return error ? std::filesystem::path() : absolute.lexically_normal();
+}
+
+// Whether path lies in one of the roots, given as normalPath() forms. No
+// ".." leads out of a root; links inside it are followed as by a local
+// scan, whichever worker gets the directories they are in.
+inline bool insideRoots(const std::string& path, const std::vector<std::filesystem::path>& roots)
+{
+    const std::filesystem::path normal = normalPath(path);
+    if (normal.empty())
+        return false;
+    for (const auto& root : roots)
+    {
+        auto mismatch = std::mismatch(root.begin(), root.end(), normal.begin(), normal.end());
+        // A trailing separator of the root leaves an empty last element.
+        if (mismatch.first != root.end() && mismatch.first->empty())
+            ++mismatch.first;
+        if (mismatch.first == root.end())
+            return true;
+    }
+    return false;
+}
+
+// Runs jobs for coordinators until the process is stopped. Coordinators are
+// served one after the other, every job with all threads of the process.
+// Only addresses of host accept connections, so a worker serves nothing
+// beyond the machine unless told so, and run refuses paths outside the
+// roots the worker was started with.
+inline std::string progressPayload(std::uint64_t id)
+{
+    wireWriter out(progress_message);
+    out.number(id);
+    return out.payload();
+}
+
+// Waits for the result of job id, skipping its progress frames.
+inline bool receiveResult(netConnection& worker, std::uint64_t id, std::string& payload, scanResult& result)
+{
+    while (worker.receive_frame(payload))
+    {
+        wireReader in(payload);
+        if (in.type() != progress_message)
+            return decodeResult(payload, result) && result.id == id;
+        if (in.number() != id || !in.ok())
+            return false;
+    }
+    return false;
+}
+
+// Runs one job, sending progress frames from another thread meanwhile.
+inline void runWithProgress(netConnection& coordinator, const scanRequest& request, scanResult& result,
+    const std::function<void(const scanRequest&, scanResult&)>& run)
+{
+    std::mutex progress_mutex;
+    std::condition_variable finished;
+    bool done = false;
+    std::thread progress([&]
+        {
+            std::unique_lock lock(progress_mutex);
+            while (!finished.wait_for(lock, heartbeatInterval, [&] { return done; }))
+            {
+                if (!coordinator.send_frame(progressPayload(request.id)))
+                    break;
+            }
+        });
+    run(request, result);
+    {
+        const std::scoped_lock lock(progress_mutex);
+        done = true;
+    }
+    finished.notify_all();
+    progress.join();
+}
+
+inline bool serveScans(const std::string& host, const std::string& port, int threads,
+    const std::function<void(const scanRequest&, scanResult&)>& run, std::ostream& log)
+{
+    netListener listener;
+    if (!listener.listen_on(host, port))
+    {
+        log << "Could not listen on " << host << " port " << port << '.' << std::endl;
+        return false;
+    }
+    log << "Waiting for a coordinator on " << host << " port " << port << '.' << std::endl;
+    std::string payload;
+    while (true)
+    {
+        netConnection coordinator(listener.accept_connection());
+        if (!coordinator.is_open())
+            continue;
+        coordinator.keep_alive();
+        coordinator.set_timeouts(silenceTimeout, silenceTimeout);
+        std::uint64_t ignored = 0;
+        if (!coordinator.receive_frame(payload) || !readHello(payload, ignored)
+            || !coordinator.send_frame(helloPayload(static_cast<std::uint64_t>(threads))))
+            continue;
+        // Between jobs a coordinator may wait long for the work of other
+        // workers; only keepalive tells whether it is still there.
+        coordinator.set_timeouts(std::chrono::milliseconds(0), silenceTimeout);
+        std::uint64_t jobs = 0;
+        scanRequest request;
+        scanResult result;
+        while (coordinator.receive_frame(payload) && decodeRequest(payload, request))
+        {
+            result = scanResult{};
+            result.id = request.id;
+            runWithProgress(coordinator, request, result, run);
+            if (!coordinator.send_frame(encodeResult(result)))
+                break;
+            jobs++;
+        }
+        log << "Coordinator done after " << jobs << " jobs." << std::endl;
+    }
+}
+
+// What one worker did for a distributed scan.
+struct workerReport {
+    std::string address;
+    std::uint64_t threads = 0;
+    std::int64_t treeJobs = 0;
+    std::int64_t levelJobs = 0;
+    // Directories sent back from tree jobs that outlasted their slice.
+    std::int64_t returned = 0;
+    counter stats;
+    double busySeconds = 0;
+    bool lost = false;
+};
+
+// Hands out the subtrees of a distributed scan. Every worker connection
+// pulls the next directory once it sent back the previous one, so a worker
+// that got small subtrees simply takes more of them. The top shardDepth
+// levels are always scanned as level jobs, which split the tree into its
+// subdirectories; deeper down a directory is only split when handing it
+// out whole would leave a waiting worker without anything to take, so the
+// work spreads out again whenever a large subtree keeps the others idle.
+// A subtree handed out whole that takes longer than jobSlice comes back in
+// pieces: the worker finishes the directories it listed and returns the
+// rest, which are handed out again like any other.
+class scanCoordinator
+{
+public:
+
+    scanCoordinator(int _shardDepth, unsigned _metrics, textEncoding _encoding)
+        : shardDepth(_shardDepth), metrics(_metrics), encoding(_encoding) {}
+
+    // Scans the roots with the workers at the given host:port addresses and
+    // adds everything to total. Fails when no worker could be used or the
+    // last one was lost before everything was scanned.
+    bool run(const std::vector<std::string>& roots, const std::vector<std::string>& addresses, counter& total,
+        std::vector<workerReport>& reports, std::string& error)
+    {
+        for (const auto& root : roots)
+            pending.push_back(pendingDirectory{ root, 0 });
+        reports.assign(addresses.size(), workerReport{});
+        std::vector<std::thread> threads;
+        for (std::size_t i = 0; i < addresses.size(); i++)
+        {
+            reports[i].address = addresses[i];
+            threads.emplace_back([this, &report = reports[i]] { serve_worker(report); });
+        }
+        for (auto& thread : threads)
+            thread.join();
+
+        total += merged;
+        if (!pending.empty() || outstanding > 0)
+        {
+            error = "No worker left, " + std::to_string(pending.size() + outstanding) + " directories were not scanned.";
+            return false;
+        }
+        if (unreadable > 0)
+            error = std::to_string(unreadable) + " directories could not be listed by the workers.";
+        return true;
+    }
+
+private:
+
+    struct pendingDirectory {
+        std::string path;
+        int depth;
+    };
+
+    // Takes the next directory, waiting while others may still add some.
+    // False once everything is done.
+    bool take(pendingDirectory& next, scanKind& kind)
+    {
+        std::unique_lock lock(queue_mutex);
+        waiting++;
+        queue_changed.wait(lock, [this] { return !pending.empty() || outstanding == 0; });
+        waiting--;
+        if (pending.empty())
+            return false;
+        next = std::move(pending.front());
+        pending.pop_front();
+        outstanding++;
+        kind = next.depth < shardDepth || static_cast<int>(pending.size()) < waiting ? scanKind::level : scanKind::tree;
+        return true;
+    }
+
+    void finish(const pendingDirectory& done, const scanResult& result)
+    {
+        {
+            const std::scoped_lock lock(queue_mutex);
+            merged += result.stats;
+            if (!result.opened)
+                unreadable++;
+            for (const auto& below : result.subdirectories)
+            {
+                const int levels = static_cast<int>(std::count(below.begin(), below.end(), '/')) + 1;
+                pending.push_back(pendingDirectory{ joinPath(done.path, below.c_str()), done.depth + levels });
+            }
+            outstanding--;
+        }
+        queue_changed.notify_all();
+    }
+
+    // A lost worker's directory goes back to the queue for the others.
+    void give_back(pendingDirectory&& directory)
+    {
+        {
+            const std::scoped_lock lock(queue_mutex);
+            pending.push_front(std::move(directory));
+            outstanding--;
+        }
+        queue_changed.notify_all();
+    }
+
+    void serve_worker(workerReport& report)
+    {
+        const std::size_t colon = report.address.rfind(':');
+        netConnection worker;
+        std::string payload;
+        if (colon == std::string::npos || !worker.connect_to(report.address.substr(0, colon), report.address.substr(colon + 1)))
+        {
+            report.lost = true;
+            return;
+        }
+        // A worker that goes silent is lost like one that disconnected.
+        worker.keep_alive();
+        worker.set_timeouts(silenceTimeout, silenceTimeout);
+        if (!worker.send_frame(helloPayload(0)) || !worker.receive_frame(payload) || !readHello(payload, report.threads))
+        {
+            report.lost = true;
+            return;
+        }
+
+        pendingDirectory directory;
+        scanRequest request;
+        scanResult result;
+        request.metrics = metrics;
+        request.encoding = encoding;
+        request.sliceMilliseconds = jobSlice;
+        while (take(directory, request.kind))
+        {
+            request.id = next_id++;
+            request.path = directory.path;
+            const auto begin = std::chrono::steady_clock::now();
+            if (!worker.send_frame(encodeRequest(request)) || !receiveResult(worker, request.id, payload, result))
+            {
+                report.lost = true;
+                give_back(std::move(directory));
+                return;
+            }
+            report.busySeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+            if (request.kind == scanKind::level)
+                report.levelJobs++;
+            else
+            {
+                report.treeJobs++;
+                report.returned += static_cast<std::int64_t>(result.subdirectories.size());
+            }
+            report.stats += result.stats;
+            finish(directory, result);
+        }
+    }
+
+    static constexpr std::uint64_t jobSlice = 1000;
+
+    int shardDepth;
+    unsigned metrics;
+    textEncoding encoding;
+    std::mutex queue_mutex;
+    std::condition_variable queue_changed;
+    std::deque<pendingDirectory> pending;
+    std::size_t outstanding = 0;
+    int waiting = 0;
+    std::int64_t unreadable = 0;
+    std::atomic<std::uint64_t> next_id = 1;
+    counter merged;
+};
+
+inline void printWorkers(std::ostream& out, const std::vector<workerReport>& reports)
+{
+    out << std::left << std::setw(24) << "worker" << std::right << std::setw(9) << "threads" << std::setw(9) << "trees"
+        << std::setw(9) << "levels" << std::setw(10) << "returned" << std::setw(12) << "files" << std::setw(12) << "busy [s]" << std::endl;
+    for (const auto& report : reports)
+    {
+        out << std::left << std::setw(24) << report.address << std::right << std::setw(9) << report.threads
+            << std::setw(9) << report.treeJobs << std::setw(9) << report.levelJobs << std::setw(10) << report.returned << std::setw(12) << report.stats.howManyFiles
+            << std::fixed << std::setprecision(3) << std::setw(12) << report.busySeconds << std::setprecision(6);
+        if (report.lost)
+            out << "  lost";
+        out << std::endl;
+    }
+    out.unsetf(std::ios::fixed);
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Everything found by one walk of the tree, so that the files can be
+// analyzed any number of times without walking it again. Stored as flat
+// arrays: file names and directory paths are NUL-terminated strings in one
+// buffer, every file points to its directory by index.
+struct fileManifest {
+    std::string strings;
+    std::vector<std::uint64_t> directoryOffsets;
+    std::vector<std::uint64_t> nameOffsets;
+    std::vector<std::uint32_t> parents;
+    std::vector<std::uintmax_t> sizes;
+    std::uintmax_t totalBytes = 0;
+
+    std::size_t size() const
+    {
+        return sizes.size();
+    }
+
+    // Files of one directory are expected one after the other, which is how
+    // a walk of that directory reports them.
+    void add_file(std::string_view directory, std::string_view name, std::uintmax_t size)
+    {
+        if (directoryOffsets.empty() || directory != std::string_view(strings.c_str() + directoryOffsets.back()))
+        {
+            directoryOffsets.push_back(strings.size());
+            strings.append(directory).push_back(0);
+        }
+        nameOffsets.push_back(strings.size());
+        strings.append(name).push_back(0);
+        parents.push_back(static_cast<std::uint32_t>(directoryOffsets.size() - 1));
+        sizes.push_back(size);
+        totalBytes += size;
+    }
+
+    // Builds the full path of file i in path, reusing its memory.
+    void path_of(std::size_t i, std::string& path) const
+    {
+        const std::string_view directory(strings.c_str() + directoryOffsets[parents[i]]);
+        path.assign(directory);
+        if (!path.empty() && path.back() != '/' && path.back() != '\\')
+            path += '/';
+        path.append(strings.c_str() + nameOffsets[i]);
+    }
+
+    fileManifest& operator+=(const fileManifest& other)
+    {
+        const std::uint64_t stringBase = strings.size();
+        const std::uint32_t directoryBase = static_cast<std::uint32_t>(directoryOffsets.size());
+        strings += other.strings;
+        for (std::uint64_t offset : other.directoryOffsets)
+            directoryOffsets.push_back(stringBase + offset);
+        for (std::uint64_t offset : other.nameOffsets)
+            nameOffsets.push_back(stringBase + offset);
+        for (std::uint32_t parent : other.parents)
+            parents.push_back(directoryBase + parent);
+        sizes.insert(sizes.end(), other.sizes.begin(), other.sizes.end());
+        totalBytes += other.totalBytes;
+        return *this;
+    }
+};
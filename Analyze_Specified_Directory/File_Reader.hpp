@@ -0,0 +1,183 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+
+#include "Phase_Profiler.hpp"
+#include "Resource_Limits.hpp"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Size of the buffer used when a file can't be mapped.
+constexpr std::size_t readBufferSize = 1 << 20;
+
+// Set, before any file is counted, while files are expected to change
+// during the run (the watch); their contents are then always read into a
+// buffer, see the mapping in mappedFile.
+inline bool streamFileReads = false;
+
+// Read-only view of a whole file mapped into memory.
+class mappedFile
+{
+public:
+
+    mappedFile(const char* path);
+
+    ~mappedFile();
+
+    mappedFile(const mappedFile&) = delete;
+    mappedFile& operator=(const mappedFile&) = delete;
+
+    // True when the file was opened and mapped. Files reporting a size of
+    // zero are never mapped, as pseudo files (e.g. /proc) still have content.
+    bool is_mapped() const;
+
+    const char* data() const;
+
+    std::size_t size() const;
+
+private:
+
+    const char* view = nullptr;
+    std::size_t view_size = 0;
+    bool mapped = false;
+};
+
+mappedFile::mappedFile(const char* path)
+{
+    // A mapping keeps no descriptor, the file is only open in here.
+    const openFileSlot slot;
+    ASD_PROFILE_PHASE(profilePhase::open);
+#ifdef _WIN32
+    HANDLE file = CreateFileW(std::filesystem::path(path).c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+        nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return;
+    ASD_PROFILE_EVENT(profileEvent::filesOpened, 1);
+    LARGE_INTEGER fileSize;
+    if (GetFileSizeEx(file, &fileSize) && static_cast<unsigned long long>(fileSize.QuadPart) <= SIZE_MAX)
+    {
+        view_size = static_cast<std::size_t>(fileSize.QuadPart);
+        HANDLE mapping = view_size > 0 ? CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+        if (mapping != nullptr)
+        {
+            view = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+            mapped = view != nullptr;
+            CloseHandle(mapping);
+        }
+    }
+    CloseHandle(file);
+#else
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+    ASD_PROFILE_EVENT(profileEvent::filesOpened, 1);
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode))
+    {
+        view_size = static_cast<std::size_t>(info.st_size);
+        // Pages beyond the end of a file truncated while it is mapped raise
+        // SIGBUS when touched, which ends the program; streamFileReads keeps
+        // files that may be written meanwhile away from here.
+        void* address = view_size > 0 ? mmap(nullptr, view_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        if (address != MAP_FAILED)
+        {
+            madvise(address, view_size, MADV_SEQUENTIAL);
+            view = static_cast<const char*>(address);
+            mapped = true;
+        }
+    }
+    close(fd);
+#endif
+}
+
+mappedFile::~mappedFile()
+{
+    if (view == nullptr)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(view);
+#else
+    munmap(const_cast<char*>(view), view_size);
+#endif
+}
+
+bool mappedFile::is_mapped() const
+{
+    return mapped;
+}
+
+const char* mappedFile::data() const
+{
+    return view;
+}
+
+std::size_t mappedFile::size() const
+{
+    return mapped ? view_size : 0;
+}
+
+// Passes the whole content of the file to consume(data, size) in blocks of
+// readBufferSize bytes. Returns false when the file can't be opened.
+template <typename F>
+bool readStreamBlocks(const char* path, F&& consume)
+{
+    const openFileSlot slot;
+    std::ifstream inFile;
+    {
+        ASD_PROFILE_PHASE(profilePhase::open);
+        inFile.open(path, std::ios::binary);
+    }
+    if (!inFile)
+        return false;
+    ASD_PROFILE_EVENT(profileEvent::filesOpened, 1);
+
+    thread_local std::unique_ptr<char[]> buffer(new char[readBufferSize]);
+    while (inFile)
+    {
+        {
+            ASD_PROFILE_PHASE(profilePhase::read);
+            inFile.read(buffer.get(), readBufferSize);
+        }
+        const std::streamsize got = inFile.gcount();
+        if (got <= 0)
+            break;
+        ASD_PROFILE_EVENT(profileEvent::bytesRead, got);
+        consume(buffer.get(), static_cast<std::size_t>(got));
+    }
+    return true;
+}
+
+// Passes the whole content of the file to consume(data, size), in one piece
+// when the file can be mapped and in readBufferSize blocks otherwise or with
+// streamFileReads. Returns false when the file can't be opened.
+template <typename F>
+bool readFileBlocks(const char* path, F&& consume)
+{
+    if (!streamFileReads)
+    {
+        const mappedFile file(path);
+        if (file.is_mapped())
+        {
+            consume(file.data(), file.size());
+            return true;
+        }
+    }
+    return readStreamBlocks(path, consume);
+}
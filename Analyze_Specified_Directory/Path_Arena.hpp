@@ -0,0 +1,133 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+// Bump allocator for NUL-terminated paths. Paths are packed one after the
+// other into large blocks. A path stays valid until it is given back with
+// release() or the arena is cleared; a block whose paths were all given back
+// is reused once the arena moved on to the next one, so a walk that gives
+// back what it is done with needs only the blocks of the paths still in use.
+class pathArena
+{
+public:
+
+    pathArena() = default;
+
+    pathArena(const pathArena&) = delete;
+    pathArena& operator=(const pathArena&) = delete;
+
+    // Stores directory and name joined with a single separator.
+    const char* join(std::string_view directory, std::string_view name)
+    {
+        const bool separator = !directory.empty() && directory.back() != '/' && directory.back() != '\\';
+        char* path = allocate(directory.size() + separator + name.size() + 1);
+        char* next = std::copy(directory.begin(), directory.end(), path);
+        if (separator)
+            *next++ = '/';
+        next = std::copy(name.begin(), name.end(), next);
+        *next = 0;
+        return path;
+    }
+
+    const char* store(std::string_view path)
+    {
+        char* stored = allocate(path.size() + 1);
+        std::memcpy(stored, path.data(), path.size());
+        stored[path.size()] = 0;
+        return stored;
+    }
+
+    // Gives back a path of any arena, from any thread.
+    static void release(const char* path)
+    {
+        block* owner;
+        std::memcpy(&owner, path - sizeof(block*), sizeof(block*));
+        if (--owner->live == 0)
+            owner->arena->recycle(owner);
+    }
+
+    // Makes every block free again. Call only when no path is in use.
+    void clear()
+    {
+        const std::scoped_lock lock(free_mutex);
+        free_blocks.clear();
+        for (auto& stored : blocks)
+        {
+            stored->live = 1;
+            free_blocks.push_back(stored.get());
+        }
+        current = nullptr;
+    }
+
+private:
+
+    struct block {
+        std::unique_ptr<char[]> data;
+        std::size_t size;
+        pathArena* arena;
+        // One for every path not given back, plus one while the arena
+        // still allocates from the block.
+        std::atomic<std::int64_t> live = 1;
+    };
+
+    // Every path is preceded by the block it lives in.
+    char* allocate(std::size_t bytes)
+    {
+        const std::size_t needed = (sizeof(block*) + bytes + alignof(block*) - 1) & ~(alignof(block*) - 1);
+        if (current == nullptr || used + needed > current->size)
+        {
+            if (current != nullptr && --current->live == 0)
+                recycle(current);
+            current = take_block(needed);
+            used = 0;
+        }
+        char* result = current->data.get() + used;
+        std::memcpy(result, &current, sizeof(block*));
+        current->live++;
+        used += needed;
+        return result + sizeof(block*);
+    }
+
+    block* take_block(std::size_t bytes)
+    {
+        {
+            const std::scoped_lock lock(free_mutex);
+            const auto found = std::find_if(free_blocks.begin(), free_blocks.end(), [bytes](const block* free) { return free->size >= bytes; });
+            if (found != free_blocks.end())
+            {
+                block* reused = *found;
+                *found = free_blocks.back();
+                free_blocks.pop_back();
+                reused->live = 1;
+                return reused;
+            }
+        }
+        const std::size_t size = std::max(bytes, block_size);
+        auto created = std::make_unique<block>();
+        created->data = std::make_unique<char[]>(size);
+        created->size = size;
+        created->arena = this;
+        blocks.push_back(std::move(created));
+        return blocks.back().get();
+    }
+
+    void recycle(block* freed)
+    {
+        const std::scoped_lock lock(free_mutex);
+        free_blocks.push_back(freed);
+    }
+
+    static constexpr std::size_t block_size = 256 * 1024;
+
+    std::vector<std::unique_ptr<block>> blocks;
+    block* current = nullptr;
+    std::size_t used = 0;
+    std::mutex free_mutex;
+    std::vector<block*> free_blocks;
+};
@@ -0,0 +1,270 @@
+#pragma once
+#include <cstdint>
+
+// Built-in profiling of the hot paths. Build with ASD_PROFILING=1 to get
+// per-thread time per phase and event counters, and --profile / --trace to
+// report them; without it every probe compiles to nothing.
+#ifndef ASD_PROFILING
+#define ASD_PROFILING 0
+#endif
+
+// What a thread spends its time on. Phases nest: the time of an inner
+// phase is not counted for the outer one.
+enum class profilePhase
+{
+    // Listing and looking up directories.
+    walk,
+    // Opening and mapping files.
+    open,
+    // Reading file contents, or waiting for asynchronous reads.
+    read,
+    // The byte counting kernel.
+    count,
+    // Printing found entries through sync_out.
+    listing,
+    // A discovery thread waiting for room in the analysis queue.
+    queueWait,
+    // A worker waiting for a task.
+    idle,
+    phaseCount
+};
+
+enum class profileEvent
+{
+    filesOpened,
+    bytesRead,
+    bytesCounted,
+    directoriesListed,
+    tasksRun,
+    tasksStolen,
+    eventCount
+};
+
+#if ASD_PROFILING
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Thread_Shards.hpp"
+
+constexpr int profilePhases = static_cast<int>(profilePhase::phaseCount);
+constexpr int profileEvents = static_cast<int>(profileEvent::eventCount);
+
+inline const char* phaseName(profilePhase phase)
+{
+    static constexpr const char* names[profilePhases] = { "walk", "open", "read", "count", "listing", "queue wait", "idle" };
+    return names[static_cast<int>(phase)];
+}
+
+inline const char* eventName(profileEvent event)
+{
+    static constexpr const char* names[profileEvents] = { "files opened", "bytes read", "bytes counted", "directories listed", "tasks run", "tasks stolen" };
+    return names[static_cast<int>(event)];
+}
+
+// Everything one thread measured.
+struct threadProfile {
+    std::int64_t nanoseconds[profilePhases] = {};
+    std::int64_t events[profileEvents] = {};
+
+    threadProfile& operator+=(const threadProfile& other)
+    {
+        for (int i = 0; i < profilePhases; i++)
+            nanoseconds[i] += other.nanoseconds[i];
+        for (int i = 0; i < profileEvents; i++)
+            events[i] += other.events[i];
+        return *this;
+    }
+};
+
+// One finished phase, for the trace.
+struct traceEvent {
+    profilePhase phase;
+    std::int64_t begin;
+    std::int64_t end;
+};
+
+// Phases one thread recorded for the trace, at most trace_limit of them.
+struct threadTrace {
+    static constexpr std::size_t trace_limit = 1 << 20;
+
+    int thread_id = 0;
+    std::vector<traceEvent> events;
+    std::int64_t dropped = 0;
+};
+
+class phaseProfiler
+{
+public:
+
+    using clock = std::chrono::steady_clock;
+
+    // Call before the measured work starts.
+    void enable_trace()
+    {
+        tracing = true;
+    }
+
+    std::int64_t now() const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - origin).count();
+    }
+
+    threadProfile& local()
+    {
+        return profiles.local();
+    }
+
+    void record(profilePhase phase, std::int64_t begin, std::int64_t end)
+    {
+        if (!tracing)
+            return;
+        threadTrace& trace = traces.local();
+        if (trace.thread_id == 0)
+            trace.thread_id = ++next_thread_id;
+        if (trace.events.size() < threadTrace::trace_limit)
+            trace.events.push_back(traceEvent{ phase, begin, end });
+        else
+            trace.dropped++;
+    }
+
+    // Prints the totals of every phase and event, then one row per thread
+    // that measured anything. Call only when no thread is working anymore.
+    void print(std::ostream& out)
+    {
+        const threadProfile total = profiles.merge();
+        std::int64_t allTime = 0;
+        for (std::int64_t time : total.nanoseconds)
+            allTime += time;
+
+        out << std::left << std::setw(20) << "phase" << std::right << std::setw(14) << "time [s]" << std::setw(10) << "share" << '\n';
+        for (int i = 0; i < profilePhases; i++)
+        {
+            out << std::left << std::setw(20) << phaseName(static_cast<profilePhase>(i)) << std::right << std::fixed
+                << std::setprecision(6) << std::setw(14) << total.nanoseconds[i] * 1e-9
+                << std::setprecision(2) << std::setw(9) << (allTime > 0 ? 100.0 * total.nanoseconds[i] / allTime : 0) << "%\n";
+        }
+        out << '\n';
+        for (int i = 0; i < profileEvents; i++)
+            out << std::left << std::setw(20) << eventName(static_cast<profileEvent>(i)) << std::right << std::setw(14) << total.events[i] << '\n';
+
+        out << '\n' << std::setw(8) << "thread";
+        for (int i = 0; i < profilePhases; i++)
+            out << std::setw(12) << phaseName(static_cast<profilePhase>(i));
+        out << std::setw(10) << "files" << std::setw(10) << "tasks" << std::setw(10) << "steals" << '\n';
+        int thread = 0;
+        profiles.for_each([&](const threadProfile& profile)
+            {
+                thread++;
+                if (std::all_of(std::begin(profile.nanoseconds), std::end(profile.nanoseconds), [](std::int64_t time) { return time == 0; }))
+                    return;
+                out << std::setw(8) << thread << std::setprecision(3);
+                for (std::int64_t time : profile.nanoseconds)
+                    out << std::setw(12) << time * 1e-9;
+                out << std::setw(10) << profile.events[static_cast<int>(profileEvent::filesOpened)]
+                    << std::setw(10) << profile.events[static_cast<int>(profileEvent::tasksRun)]
+                    << std::setw(10) << profile.events[static_cast<int>(profileEvent::tasksStolen)] << '\n';
+            });
+        out << std::setprecision(6);
+    }
+
+    // Writes the recorded phases in the Chrome trace event format, which
+    // chrome://tracing and Perfetto open. Call only when no thread is
+    // working anymore.
+    bool write_trace(const std::string& path)
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        bool first = true;
+        std::int64_t dropped = 0;
+        traces.for_each([&](const threadTrace& trace)
+            {
+                dropped += trace.dropped;
+                for (const auto& event : trace.events)
+                {
+                    out << (first ? "\n" : ",\n") << "{\"name\":\"" << phaseName(event.phase)
+                        << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << trace.thread_id << std::fixed << std::setprecision(3)
+                        << ",\"ts\":" << event.begin * 1e-3 << ",\"dur\":" << (event.end - event.begin) * 1e-3 << '}';
+                    first = false;
+                }
+            });
+        out << "\n],\"otherData\":{\"droppedEvents\":" << dropped << "}}\n";
+        out.close();
+        return !out.fail();
+    }
+
+private:
+
+    const clock::time_point origin = clock::now();
+    threadShards<threadProfile> profiles;
+    threadShards<threadTrace> traces;
+    std::atomic<int> next_thread_id = 0;
+    bool tracing = false;
+};
+
+// Never destroyed: workers of the global pools may still finish a phase
+// while the program exits.
+inline phaseProfiler& profiler()
+{
+    static phaseProfiler* instance = new phaseProfiler;
+    return *instance;
+}
+
+// Measures the enclosing scope as one phase. While an inner timer runs the
+// outer one is paused.
+class phaseTimer
+{
+public:
+
+    explicit phaseTimer(profilePhase _phase)
+        : phase(_phase), parent(active)
+    {
+        begin = resumed = profiler().now();
+        if (parent != nullptr)
+            parent->charge(begin);
+        active = this;
+    }
+
+    ~phaseTimer()
+    {
+        const std::int64_t end = profiler().now();
+        charge(end);
+        profiler().record(phase, begin, end);
+        if (parent != nullptr)
+            parent->resumed = end;
+        active = parent;
+    }
+
+    phaseTimer(const phaseTimer&) = delete;
+    phaseTimer& operator=(const phaseTimer&) = delete;
+
+private:
+
+    void charge(std::int64_t until)
+    {
+        profiler().local().nanoseconds[static_cast<int>(phase)] += until - resumed;
+        resumed = until;
+    }
+
+    inline static thread_local phaseTimer* active = nullptr;
+
+    profilePhase phase;
+    phaseTimer* parent;
+    std::int64_t begin = 0;
+    std::int64_t resumed = 0;
+};
+
+#define ASD_PROFILE_CONCAT_(a, b) a##b
+#define ASD_PROFILE_CONCAT(a, b) ASD_PROFILE_CONCAT_(a, b)
+#define ASD_PROFILE_PHASE(phase) const phaseTimer ASD_PROFILE_CONCAT(profiledPhase, __LINE__)(phase)
+#define ASD_PROFILE_EVENT(event, amount) (profiler().local().events[static_cast<int>(event)] += static_cast<std::int64_t>(amount))
+#else
+#define ASD_PROFILE_PHASE(phase) ((void)0)
+#define ASD_PROFILE_EVENT(event, amount) ((void)0)
+#endif
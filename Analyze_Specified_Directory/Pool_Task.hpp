@@ -0,0 +1,243 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Move-only callable with fixed inline storage, so a queued task never
+// allocates. Callables larger than inline_size are rejected at compile time;
+// capture a pointer to the data instead.
+class poolTask
+{
+public:
+
+	static constexpr std::size_t inline_size = 48;
+
+	poolTask() = default;
+
+	template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, poolTask>>>
+	poolTask(F&& callable)
+	{
+		using stored = std::decay_t<F>;
+		static_assert(sizeof(stored) <= inline_size, "The task doesn't fit into poolTask::inline_size bytes.");
+		static_assert(alignof(stored) <= alignof(std::max_align_t), "The task is over-aligned for poolTask.");
+		static_assert(std::is_nothrow_move_constructible_v<stored>, "The task has to be nothrow movable.");
+		new (storage) stored(std::forward<F>(callable));
+		ops = &operations_for<stored>;
+	}
+
+	poolTask(poolTask&& other) noexcept
+	{
+		take(other);
+	}
+
+	poolTask& operator=(poolTask&& other) noexcept
+	{
+		if (this != &other)
+		{
+			reset();
+			take(other);
+		}
+		return *this;
+	}
+
+	poolTask(const poolTask&) = delete;
+	poolTask& operator=(const poolTask&) = delete;
+
+	~poolTask()
+	{
+		reset();
+	}
+
+	explicit operator bool() const
+	{
+		return ops != nullptr;
+	}
+
+	void operator()()
+	{
+		ops->invoke(storage);
+	}
+
+	void reset()
+	{
+		if (ops != nullptr)
+		{
+			ops->destroy(storage);
+			ops = nullptr;
+		}
+	}
+
+private:
+
+	struct operations
+	{
+		void (*invoke)(void* callable);
+		void (*move)(void* from, void* to);
+		void (*destroy)(void* callable);
+	};
+
+	template <typename F>
+	static constexpr operations operations_for = {
+		[](void* callable) { (*static_cast<F*>(callable))(); },
+		[](void* from, void* to) { new (to) F(std::move(*static_cast<F*>(from))); static_cast<F*>(from)->~F(); },
+		[](void* callable) { static_cast<F*>(callable)->~F(); }
+	};
+
+	void take(poolTask& other) noexcept
+	{
+		if (other.ops != nullptr)
+		{
+			other.ops->move(other.storage, storage);
+			ops = other.ops;
+			other.ops = nullptr;
+		}
+	}
+
+	alignas(std::max_align_t) unsigned char storage[inline_size];
+	const operations* ops = nullptr;
+};
+
+// Double-ended queue of tasks in one ring of slots. The ring only grows, so
+// once it reached the size a walk needs, pushing and popping reuse the same
+// slots and never allocate.
+class taskRing
+{
+public:
+
+	bool empty() const
+	{
+		return count == 0;
+	}
+
+	std::size_t size() const
+	{
+		return count;
+	}
+
+	void push_back(poolTask&& task)
+	{
+		if (count == slots.size())
+			grow();
+		slots[(head + count) & (slots.size() - 1)] = std::move(task);
+		count++;
+	}
+
+	poolTask pop_front()
+	{
+		poolTask task = std::move(slots[head]);
+		head = (head + 1) & (slots.size() - 1);
+		count--;
+		return task;
+	}
+
+	poolTask pop_back()
+	{
+		count--;
+		return std::move(slots[(head + count) & (slots.size() - 1)]);
+	}
+
+private:
+
+	void grow()
+	{
+		std::vector<poolTask> larger(slots.empty() ? 64 : slots.size() * 2);
+		for (std::size_t i = 0; i < count; i++)
+			larger[i] = std::move(slots[(head + i) & (slots.size() - 1)]);
+		slots.swap(larger);
+		head = 0;
+	}
+
+	std::vector<poolTask> slots;
+	std::size_t head = 0;
+	std::size_t count = 0;
+};
+
+// Bounded lock-free multi-producer multi-consumer queue of tasks (Vyukov's
+// ring): every cell carries a sequence number telling producers and
+// consumers whose turn it is, so pushing and popping is one CAS each.
+class mpmcTaskRing
+{
+public:
+
+	// capacity has to be a power of two.
+	explicit mpmcTaskRing(std::size_t capacity)
+		: cells(new cell[capacity]), mask(capacity - 1)
+	{
+		for (std::size_t i = 0; i < capacity; i++)
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	// Moves the task in, unless the ring is full; then it is left as it was.
+	bool try_push(poolTask& task)
+	{
+		std::size_t position = enqueue_position.load(std::memory_order_relaxed);
+		cell* target;
+		while (true)
+		{
+			target = &cells[position & mask];
+			const std::size_t sequence = target->sequence.load(std::memory_order_acquire);
+			const std::ptrdiff_t difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position);
+			if (difference == 0)
+			{
+				if (enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (difference < 0)
+			{
+				return false;
+			}
+			else
+			{
+				position = enqueue_position.load(std::memory_order_relaxed);
+			}
+		}
+		target->task = std::move(task);
+		target->sequence.store(position + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool try_pop(poolTask& task)
+	{
+		std::size_t position = dequeue_position.load(std::memory_order_relaxed);
+		cell* source;
+		while (true)
+		{
+			source = &cells[position & mask];
+			const std::size_t sequence = source->sequence.load(std::memory_order_acquire);
+			const std::ptrdiff_t difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position + 1);
+			if (difference == 0)
+			{
+				if (dequeue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (difference < 0)
+			{
+				return false;
+			}
+			else
+			{
+				position = dequeue_position.load(std::memory_order_relaxed);
+			}
+		}
+		task = std::move(source->task);
+		source->sequence.store(position + mask + 1, std::memory_order_release);
+		return true;
+	}
+
+private:
+
+	struct alignas(64) cell
+	{
+		std::atomic<std::size_t> sequence;
+		poolTask task;
+	};
+
+	std::unique_ptr<cell[]> cells;
+	const std::size_t mask;
+	alignas(64) std::atomic<std::size_t> enqueue_position = 0;
+	alignas(64) std::atomic<std::size_t> dequeue_position = 0;
+};
@@ -0,0 +1,163 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+// A budget of something all threads share, like open files or bytes in
+// flight. acquire() waits until the amount fits, but always admits it when
+// nothing is held, so one item larger than the whole budget still passes.
+// Without a limit every call returns at once.
+class resourceLimit
+{
+public:
+
+    static constexpr std::uint64_t unlimited = std::numeric_limits<std::uint64_t>::max();
+
+    // Call only while nothing is held.
+    void set_limit(std::uint64_t _limit)
+    {
+        limit = _limit;
+    }
+
+    bool limited() const
+    {
+        return limit != unlimited;
+    }
+
+    void acquire(std::uint64_t amount)
+    {
+        if (!limited())
+            return;
+        std::uint64_t current = used.load();
+        while (!take(current, amount))
+        {
+            waiters++;
+            used.wait(current);
+            waiters--;
+            current = used.load();
+        }
+    }
+
+    bool try_acquire(std::uint64_t amount)
+    {
+        if (!limited())
+            return true;
+        std::uint64_t current = used.load();
+        return take(current, amount);
+    }
+
+    // Takes the amount even when it doesn't fit.
+    void force_acquire(std::uint64_t amount)
+    {
+        if (limited())
+            used.fetch_add(amount);
+    }
+
+    void release(std::uint64_t amount)
+    {
+        if (!limited())
+            return;
+        used.fetch_sub(amount);
+        if (waiters > 0)
+            used.notify_all();
+    }
+
+private:
+
+    // Adds amount when it fits into the budget; current gets the value
+    // found when it doesn't.
+    bool take(std::uint64_t& current, std::uint64_t amount)
+    {
+        while (current == 0 || current + amount <= limit)
+        {
+            if (used.compare_exchange_weak(current, current + amount))
+                return true;
+        }
+        return false;
+    }
+
+    std::uint64_t limit = unlimited;
+    std::atomic<std::uint64_t> used = 0;
+    std::atomic<int> waiters = 0;
+};
+
+// Files held open at once for counting, by all analysis threads together.
+// A thread that already holds one is never made to wait for another, which
+// could wait forever on threads doing the same; such a thread goes over the
+// limit by one at most for its synchronous fallbacks.
+inline resourceLimit openFiles;
+inline thread_local int heldFiles = 0;
+
+inline void acquireOpenFile()
+{
+    if (heldFiles++ == 0)
+        openFiles.acquire(1);
+    else
+        openFiles.force_acquire(1);
+}
+
+// May only fail for a thread that holds files already.
+inline bool tryAcquireOpenFile()
+{
+    if (heldFiles == 0)
+        openFiles.acquire(1);
+    else if (!openFiles.try_acquire(1))
+        return false;
+    heldFiles++;
+    return true;
+}
+
+inline void releaseOpenFile()
+{
+    heldFiles--;
+    openFiles.release(1);
+}
+
+// Holds one open file for the scope.
+class openFileSlot
+{
+public:
+
+    openFileSlot()
+    {
+        acquireOpenFile();
+    }
+
+    ~openFileSlot()
+    {
+        releaseOpenFile();
+    }
+
+    openFileSlot(const openFileSlot&) = delete;
+    openFileSlot& operator=(const openFileSlot&) = delete;
+};
+
+// Open files allowed by default: what the descriptor limit of the process
+// leaves after reserve for directory listings, the cache and the output.
+// Raises the soft limit to the hard one first. Unlimited on Windows, where
+// handles have no such limit.
+inline std::uint64_t defaultOpenFileLimit(std::uint64_t reserve)
+{
+#ifdef _WIN32
+    (void)reserve;
+    return resourceLimit::unlimited;
+#else
+    rlimit files;
+    if (getrlimit(RLIMIT_NOFILE, &files) != 0 || files.rlim_cur == RLIM_INFINITY)
+        return resourceLimit::unlimited;
+    if (files.rlim_cur < files.rlim_max)
+    {
+        rlimit raised = files;
+        raised.rlim_cur = files.rlim_max == RLIM_INFINITY ? std::max<rlim_t>(files.rlim_cur, 1 << 20) : files.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &raised) == 0)
+            files = raised;
+    }
+    const std::uint64_t available = static_cast<std::uint64_t>(files.rlim_cur);
+    return available > reserve + 16 ? available - reserve : 16;
+#endif
+}
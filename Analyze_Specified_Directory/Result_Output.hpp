@@ -0,0 +1,298 @@
+#pragma once
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Benchmark.hpp"
+#include "Stats_Counter.hpp"
+#include "Synced_Stream.hpp"
+
+// Formats of the machine-readable results.
+enum class resultFormat
+{
+    // One JSON object per line.
+    jsonl,
+    // One table with a header row; fields a record doesn't have stay empty.
+    csv,
+    // Tagged records in the byte order of the machine, after an "ASDR"
+    // magic and a version.
+    binary
+};
+
+// Writes per-file records, the totals and the benchmark timings to a file
+// while the scan runs. Records are formatted by the thread that counted
+// the file into its own buffer of a buffered syncedStream, so the workers
+// never wait for each other or for the disk and nothing is held in memory
+// beyond the buffers.
+class resultWriter
+{
+public:
+
+    static constexpr std::uint32_t binary_version = 1;
+
+    // Binary record tags.
+    enum recordTag : std::uint8_t
+    {
+        file_record = 1,
+        totals_record = 2,
+        benchmark_record = 3
+    };
+
+    resultWriter(const std::string& path, resultFormat _format)
+        : file(path, std::ios::binary | std::ios::trunc), stream(file, outputMode::buffered), format(_format)
+    {
+        std::string& record = begin_record();
+        if (format == resultFormat::csv)
+        {
+            record += "record,path,threads,runs,directories,files,non_empty_lines,empty_lines,words,letters,"
+                "min_s,median_s,p95_s,stddev_s,speedup,efficiency\n";
+        }
+        else if (format == resultFormat::binary)
+        {
+            record += "ASDR";
+            append_raw(record, binary_version);
+        }
+        stream.print(std::string_view(record));
+    }
+
+    bool is_open() const
+    {
+        return file.is_open();
+    }
+
+    // Safe to call from any number of threads at once.
+    void write_file(std::string_view path, const counter& stats)
+    {
+        std::string& record = begin_record();
+        switch (format)
+        {
+        case resultFormat::jsonl:
+            record += "{\"type\":\"file\",\"path\":";
+            append_json_string(record, path);
+            append_json_counts(record, stats, false);
+            record += "}\n";
+            break;
+        case resultFormat::csv:
+            record += "file,";
+            append_csv_field(record, path);
+            record += ",,,,,";
+            append_csv_counts(record, stats);
+            record += ",,,,,,\n";
+            break;
+        case resultFormat::binary:
+            record.push_back(static_cast<char>(file_record));
+            append_raw(record, static_cast<std::uint32_t>(path.size()));
+            record += path;
+            append_raw(record, stats.nonEmptyLines);
+            append_raw(record, stats.emptyLines);
+            append_raw(record, stats.numWords);
+            append_raw(record, stats.letters);
+            break;
+        }
+        stream.print(std::string_view(record));
+    }
+
+    // Call once the scan is done; the buffered file records of all threads
+    // are written out first, so the totals follow them.
+    void write_totals(const counter& total)
+    {
+        stream.flush();
+        std::string& record = begin_record();
+        switch (format)
+        {
+        case resultFormat::jsonl:
+            record += "{\"type\":\"totals\"";
+            append_json_counts(record, total, true);
+            record += "}\n";
+            break;
+        case resultFormat::csv:
+            record += "totals,,,,";
+            append_number(record, total.howManyDirectories);
+            record += ',';
+            append_number(record, total.howManyFiles);
+            record += ',';
+            append_csv_counts(record, total);
+            record += ",,,,,,\n";
+            break;
+        case resultFormat::binary:
+            record.push_back(static_cast<char>(totals_record));
+            append_raw(record, total.howManyDirectories);
+            append_raw(record, total.howManyFiles);
+            append_raw(record, total.nonEmptyLines);
+            append_raw(record, total.emptyLines);
+            append_raw(record, total.numWords);
+            append_raw(record, total.letters);
+            break;
+        }
+        stream.print(std::string_view(record));
+    }
+
+    // One record per thread count, the same rows printBenchmark shows.
+    void write_benchmark(const std::vector<benchmarkSeries>& series)
+    {
+        for (const auto& row : summarizeBenchmark(series))
+        {
+            std::string& record = begin_record();
+            const double timings[] = { row.stats.min, row.stats.median, row.stats.p95, row.stats.stddev, row.speedup, row.efficiency };
+            switch (format)
+            {
+            case resultFormat::jsonl:
+            {
+                static constexpr const char* names[] = { "min", "median", "p95", "stddev", "speedup", "efficiency" };
+                record += "{\"type\":\"benchmark\",\"threads\":";
+                append_number(record, row.threads);
+                record += ",\"runs\":";
+                append_number(record, row.runs);
+                for (std::size_t i = 0; i < std::size(timings); i++)
+                {
+                    record += ",\"";
+                    record += names[i];
+                    record += "\":";
+                    append_number(record, timings[i]);
+                }
+                record += "}\n";
+                break;
+            }
+            case resultFormat::csv:
+                record += "benchmark,,";
+                append_number(record, row.threads);
+                record += ',';
+                append_number(record, row.runs);
+                record += ",,,,,,";
+                for (double timing : timings)
+                {
+                    record += ',';
+                    append_number(record, timing);
+                }
+                record += '\n';
+                break;
+            case resultFormat::binary:
+                record.push_back(static_cast<char>(benchmark_record));
+                append_raw(record, static_cast<std::int32_t>(row.threads));
+                append_raw(record, static_cast<std::int32_t>(row.runs));
+                for (double timing : timings)
+                    append_raw(record, timing);
+                break;
+            }
+            stream.print(std::string_view(record));
+        }
+    }
+
+    // Writes out everything and tells whether all of it reached the file.
+    bool close()
+    {
+        stream.flush();
+        file.close();
+        return !file.fail();
+    }
+
+private:
+
+    // Every thread formats its record in the same string over and over.
+    static std::string& begin_record()
+    {
+        thread_local std::string record;
+        record.clear();
+        return record;
+    }
+
+    template <typename T>
+    static void append_number(std::string& out, T value)
+    {
+        char digits[32];
+        const auto result = std::to_chars(digits, digits + sizeof(digits), value);
+        out.append(digits, result.ptr);
+    }
+
+    template <typename T>
+    static void append_raw(std::string& out, T value)
+    {
+        char bytes[sizeof(T)];
+        std::memcpy(bytes, &value, sizeof(T));
+        out.append(bytes, sizeof(T));
+    }
+
+    // Paths are written byte for byte, only quotes, backslashes and control
+    // characters are escaped.
+    static void append_json_string(std::string& out, std::string_view text)
+    {
+        static constexpr char hex[] = "0123456789abcdef";
+        out += '"';
+        for (char c : text)
+        {
+            const unsigned char byte = static_cast<unsigned char>(c);
+            if (c == '"' || c == '\\')
+            {
+                out += '\\';
+                out += c;
+            }
+            else if (byte < 0x20)
+            {
+                out += "\\u00";
+                out += hex[byte >> 4];
+                out += hex[byte & 15];
+            }
+            else
+            {
+                out += c;
+            }
+        }
+        out += '"';
+    }
+
+    static void append_json_counts(std::string& out, const counter& stats, bool withTree)
+    {
+        if (withTree)
+        {
+            out += ",\"directories\":";
+            append_number(out, stats.howManyDirectories);
+            out += ",\"files\":";
+            append_number(out, stats.howManyFiles);
+        }
+        out += ",\"nonEmptyLines\":";
+        append_number(out, stats.nonEmptyLines);
+        out += ",\"emptyLines\":";
+        append_number(out, stats.emptyLines);
+        out += ",\"words\":";
+        append_number(out, stats.numWords);
+        out += ",\"letters\":";
+        append_number(out, stats.letters);
+    }
+
+    static void append_csv_field(std::string& out, std::string_view text)
+    {
+        if (text.find_first_of(",\"\r\n") == std::string_view::npos)
+        {
+            out += text;
+            return;
+        }
+        out += '"';
+        for (char c : text)
+        {
+            if (c == '"')
+                out += '"';
+            out += c;
+        }
+        out += '"';
+    }
+
+    static void append_csv_counts(std::string& out, const counter& stats)
+    {
+        append_number(out, stats.nonEmptyLines);
+        out += ',';
+        append_number(out, stats.emptyLines);
+        out += ',';
+        append_number(out, stats.numWords);
+        out += ',';
+        append_number(out, stats.letters);
+    }
+
+    std::ofstream file;
+    syncedStream stream;
+    resultFormat format;
+};
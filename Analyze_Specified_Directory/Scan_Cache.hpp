@@ -0,0 +1,378 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "Dir_Enumerator.hpp"
+#include "File_Reader.hpp"
+#include "Stats_Counter.hpp"
+#include "Thread_Shards.hpp"
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+// What decides whether a file changed since it was counted.
+struct fileIdentity {
+    std::uint64_t size = 0;
+    std::int64_t mtime = 0;
+    std::uint64_t inode = 0;
+
+    bool operator==(const fileIdentity&) const = default;
+};
+
+// Reads size, modification time (in ns or 100 ns ticks) and inode of a path.
+inline bool statIdentity(const char* path, fileIdentity& identity)
+{
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExW(std::filesystem::path(path).c_str(), GetFileExInfoStandard, &data))
+        return false;
+    identity.size = (std::uint64_t(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+    identity.mtime = static_cast<std::int64_t>((std::uint64_t(data.ftLastWriteTime.dwHighDateTime) << 32) | data.ftLastWriteTime.dwLowDateTime);
+    identity.inode = 0;
+#else
+    struct stat info;
+    if (stat(path, &info) != 0)
+        return false;
+    identity.size = static_cast<std::uint64_t>(info.st_size);
+#ifdef __APPLE__
+    identity.mtime = std::int64_t(info.st_mtimespec.tv_sec) * 1000000000 + info.st_mtimespec.tv_nsec;
+#else
+    identity.mtime = std::int64_t(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+#endif
+    identity.inode = static_cast<std::uint64_t>(info.st_ino);
+#endif
+    return true;
+}
+
+// A directory entry remembered by the cache.
+struct cachedChild {
+    std::string name;
+    entryType type;
+};
+
+// On-disk layout: one header, the file, directory and child records, and
+// one blob with all strings. All records are fixed size and 8-byte aligned,
+// so the file is used straight from its mapping.
+namespace cacheFormat
+{
+    constexpr char magic[8] = { 'A', 'S', 'D', 'C', 'A', 'C', 'H', 'E' };
+    constexpr std::uint32_t version = 1;
+    constexpr std::uint32_t byteOrder = 0x01020304;
+
+    struct header {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t byteOrder;
+        std::uint64_t fileCount;
+        std::uint64_t directoryCount;
+        std::uint64_t childCount;
+        std::uint64_t stringBytes;
+    };
+
+    struct fileRecord {
+        std::uint64_t pathOffset;
+        std::uint64_t pathLength;
+        fileIdentity identity;
+        std::int64_t emptyLines;
+        std::int64_t nonEmptyLines;
+        std::int64_t numWords;
+        std::int64_t letters;
+    };
+
+    struct directoryRecord {
+        std::uint64_t pathOffset;
+        std::uint64_t pathLength;
+        std::int64_t mtime;
+        std::uint64_t firstChild;
+        std::uint64_t childCount;
+    };
+
+    struct childRecord {
+        std::uint64_t nameOffset;
+        std::uint32_t nameLength;
+        std::uint32_t type;
+    };
+}
+
+// Per-file and per-directory results of the previous scan, plus the results
+// of the current one, which replace them on save().
+class scanCache
+{
+public:
+
+    // Maps the cache written by a previous run. A missing or damaged cache
+    // just means everything is counted again.
+    bool load(const std::string& path);
+
+    bool enabled() const;
+
+    void enable();
+
+    // Cached counts of the file, if it is unchanged since they were taken.
+    bool find_file(std::string_view path, const fileIdentity& identity, counter& stats) const;
+
+    // Cached entries of the directory, if its modification time is unchanged.
+    bool find_directory(std::string_view path, std::int64_t mtime, std::vector<cachedChild>& children) const;
+
+    // Remember results of the current scan. Safe to call from any thread.
+    void record_file(std::string_view path, const fileIdentity& identity, const counter& stats);
+
+    void record_directory(std::string_view path, std::int64_t mtime, std::vector<cachedChild> children);
+
+    // Writes the results of the current scan, replacing the file atomically.
+    bool save(const std::string& path);
+
+    // Visits the results recorded by the current scan: visit(path, stats)
+    // for every file and visit(path) for every directory.
+    template <typename F>
+    void for_each_file(F&& visit);
+
+    template <typename F>
+    void for_each_directory(F&& visit);
+
+private:
+
+    struct fileResult {
+        std::string path;
+        fileIdentity identity;
+        counter stats;
+    };
+
+    struct directoryResult {
+        std::string path;
+        std::int64_t mtime;
+        std::vector<cachedChild> children;
+    };
+
+    // Results recorded by one thread.
+    struct results {
+        std::vector<fileResult> files;
+        std::vector<directoryResult> directories;
+    };
+
+    std::string_view stored_string(std::uint64_t offset, std::uint64_t length) const;
+
+    bool is_enabled = false;
+    std::unique_ptr<mappedFile> mapping;
+    const cacheFormat::fileRecord* files = nullptr;
+    const cacheFormat::directoryRecord* directories = nullptr;
+    const cacheFormat::childRecord* children_records = nullptr;
+    const char* strings = nullptr;
+    std::unordered_map<std::string_view, const cacheFormat::fileRecord*> file_index;
+    std::unordered_map<std::string_view, const cacheFormat::directoryRecord*> directory_index;
+    threadShards<results> recorded;
+};
+
+// Whether count items from offset lie within total, without overflowing.
+inline bool fitsInto(std::uint64_t offset, std::uint64_t count, std::uint64_t total)
+{
+    return count <= total && offset <= total - count;
+}
+
+bool scanCache::load(const std::string& path)
+{
+    using namespace cacheFormat;
+    enable();
+    mapping = std::make_unique<mappedFile>(path.c_str());
+    const char* data = mapping->data();
+    const std::size_t size = mapping->size();
+    if (!mapping->is_mapped() || size < sizeof(header))
+    {
+        mapping.reset();
+        return false;
+    }
+
+    header head;
+    std::memcpy(&head, data, sizeof(head));
+    // The counts come from the file: each is bounded by what fits into it
+    // before they are multiplied, so a corrupt header can't wrap the sum.
+    const std::uint64_t body = size - sizeof(header);
+    const bool countsFit = head.fileCount <= body / sizeof(fileRecord) && head.directoryCount <= body / sizeof(directoryRecord)
+        && head.childCount <= body / sizeof(childRecord) && head.stringBytes <= body;
+    const std::uint64_t recordsSize = countsFit ? head.fileCount * sizeof(fileRecord) + head.directoryCount * sizeof(directoryRecord)
+        + head.childCount * sizeof(childRecord) : 0;
+    if (std::memcmp(head.magic, magic, sizeof(magic)) != 0 || head.version != version || head.byteOrder != byteOrder
+        || !countsFit || recordsSize + head.stringBytes != body)
+    {
+        mapping.reset();
+        return false;
+    }
+
+    files = reinterpret_cast<const fileRecord*>(data + sizeof(header));
+    directories = reinterpret_cast<const directoryRecord*>(files + head.fileCount);
+    children_records = reinterpret_cast<const childRecord*>(directories + head.directoryCount);
+    strings = reinterpret_cast<const char*>(children_records + head.childCount);
+
+    file_index.reserve(head.fileCount);
+    for (std::uint64_t i = 0; i < head.fileCount; i++)
+    {
+        if (fitsInto(files[i].pathOffset, files[i].pathLength, head.stringBytes))
+            file_index.emplace(stored_string(files[i].pathOffset, files[i].pathLength), &files[i]);
+    }
+    directory_index.reserve(head.directoryCount);
+    for (std::uint64_t i = 0; i < head.directoryCount; i++)
+    {
+        const directoryRecord& record = directories[i];
+        bool valid = fitsInto(record.pathOffset, record.pathLength, head.stringBytes)
+            && fitsInto(record.firstChild, record.childCount, head.childCount);
+        for (std::uint64_t child = 0; valid && child < record.childCount; child++)
+        {
+            const childRecord& entry = children_records[record.firstChild + child];
+            valid = fitsInto(entry.nameOffset, entry.nameLength, head.stringBytes);
+        }
+        if (valid)
+            directory_index.emplace(stored_string(record.pathOffset, record.pathLength), &record);
+    }
+    return true;
+}
+
+bool scanCache::enabled() const
+{
+    return is_enabled;
+}
+
+void scanCache::enable()
+{
+    is_enabled = true;
+}
+
+std::string_view scanCache::stored_string(std::uint64_t offset, std::uint64_t length) const
+{
+    return std::string_view(strings + offset, static_cast<std::size_t>(length));
+}
+
+bool scanCache::find_file(std::string_view path, const fileIdentity& identity, counter& stats) const
+{
+    const auto found = file_index.find(path);
+    if (found == file_index.end() || !(found->second->identity == identity))
+        return false;
+    const cacheFormat::fileRecord& record = *found->second;
+    stats.emptyLines = record.emptyLines;
+    stats.nonEmptyLines = record.nonEmptyLines;
+    stats.numWords = record.numWords;
+    stats.letters = record.letters;
+    return true;
+}
+
+bool scanCache::find_directory(std::string_view path, std::int64_t mtime, std::vector<cachedChild>& children) const
+{
+    const auto found = directory_index.find(path);
+    if (found == directory_index.end() || found->second->mtime != mtime)
+        return false;
+    const cacheFormat::directoryRecord& record = *found->second;
+    children.clear();
+    children.reserve(static_cast<std::size_t>(record.childCount));
+    for (std::uint64_t i = 0; i < record.childCount; i++)
+    {
+        const cacheFormat::childRecord& child = children_records[record.firstChild + i];
+        children.push_back(cachedChild{ std::string(stored_string(child.nameOffset, child.nameLength)), static_cast<entryType>(child.type) });
+    }
+    return true;
+}
+
+void scanCache::record_file(std::string_view path, const fileIdentity& identity, const counter& stats)
+{
+    recorded.local().files.push_back(fileResult{ std::string(path), identity, stats });
+}
+
+void scanCache::record_directory(std::string_view path, std::int64_t mtime, std::vector<cachedChild> children)
+{
+    recorded.local().directories.push_back(directoryResult{ std::string(path), mtime, std::move(children) });
+}
+
+bool scanCache::save(const std::string& path)
+{
+    using namespace cacheFormat;
+    std::vector<fileRecord> fileRecords;
+    std::vector<directoryRecord> directoryRecords;
+    std::vector<childRecord> childRecords;
+    std::string blob;
+
+    recorded.for_each([&](results& local)
+        {
+            for (const auto& file : local.files)
+            {
+                fileRecords.push_back(fileRecord{ blob.size(), file.path.size(), file.identity,
+                    file.stats.emptyLines, file.stats.nonEmptyLines, file.stats.numWords, file.stats.letters });
+                blob += file.path;
+            }
+            for (const auto& directory : local.directories)
+            {
+                directoryRecords.push_back(directoryRecord{ blob.size(), directory.path.size(), directory.mtime,
+                    childRecords.size(), directory.children.size() });
+                blob += directory.path;
+                for (const auto& child : directory.children)
+                {
+                    childRecords.push_back(childRecord{ blob.size(), static_cast<std::uint32_t>(child.name.size()),
+                        static_cast<std::uint32_t>(child.type) });
+                    blob += child.name;
+                }
+            }
+        });
+
+    header head{};
+    std::memcpy(head.magic, magic, sizeof(magic));
+    head.version = version;
+    head.byteOrder = byteOrder;
+    head.fileCount = fileRecords.size();
+    head.directoryCount = directoryRecords.size();
+    head.childCount = childRecords.size();
+    head.stringBytes = blob.size();
+
+    // The old mapping has to go before the file is replaced on Windows.
+    file_index.clear();
+    directory_index.clear();
+    mapping.reset();
+
+    const std::string temporary = path + ".tmp";
+    bool written = false;
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&head), sizeof(head));
+        out.write(reinterpret_cast<const char*>(fileRecords.data()), static_cast<std::streamsize>(fileRecords.size() * sizeof(fileRecord)));
+        out.write(reinterpret_cast<const char*>(directoryRecords.data()), static_cast<std::streamsize>(directoryRecords.size() * sizeof(directoryRecord)));
+        out.write(reinterpret_cast<const char*>(childRecords.data()), static_cast<std::streamsize>(childRecords.size() * sizeof(childRecord)));
+        out.write(blob.data(), static_cast<std::streamsize>(blob.size()));
+        out.close();
+        written = !out.fail();
+    }
+    std::error_code error;
+    if (written)
+        std::filesystem::rename(temporary, path, error);
+    if (!written || error)
+    {
+        // A partial cache is never left behind.
+        std::filesystem::remove(temporary, error);
+        return false;
+    }
+    return true;
+}
+
+template <typename F>
+void scanCache::for_each_file(F&& visit)
+{
+    recorded.for_each([&](results& local)
+        {
+            for (const auto& file : local.files)
+                visit(file.path, file.stats);
+        });
+}
+
+template <typename F>
+void scanCache::for_each_directory(F&& visit)
+{
+    recorded.for_each([&](results& local)
+        {
+            for (const auto& directory : local.directories)
+                visit(directory.path);
+        });
+}
@@ -0,0 +1,326 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Dir_Enumerator.hpp"
+#include "File_Reader.hpp"
+#include "Resource_Limits.hpp"
+
+// Matches one character of text against the pattern item at the start of
+// pattern: '?', a [class], an escaped or a literal character. used gets the
+// length of the item. '?' and classes never match '/'.
+inline bool matchGlobItem(std::string_view pattern, char c, std::size_t& used)
+{
+    if (pattern[0] == '?')
+    {
+        used = 1;
+        return c != '/';
+    }
+    if (pattern[0] == '\\' && pattern.size() > 1)
+    {
+        used = 2;
+        return c == pattern[1];
+    }
+    if (pattern[0] == '[')
+    {
+        std::size_t i = 1;
+        const bool negated = i < pattern.size() && (pattern[i] == '!' || pattern[i] == '^');
+        if (negated)
+            i++;
+        bool matched = false;
+        // A ']' right after the opening bracket is part of the class.
+        for (bool first = true; i < pattern.size() && (first || pattern[i] != ']'); first = false)
+        {
+            char low = pattern[i++];
+            if (low == '\\' && i < pattern.size())
+                low = pattern[i++];
+            char high = low;
+            if (i + 1 < pattern.size() && pattern[i] == '-' && pattern[i + 1] != ']')
+            {
+                high = pattern[i + 1];
+                i += 2;
+            }
+            matched |= c >= low && c <= high;
+        }
+        // Without a closing bracket the '[' is an ordinary character.
+        if (i < pattern.size())
+        {
+            used = i + 1;
+            return c != '/' && matched != negated;
+        }
+    }
+    used = 1;
+    return c == pattern[0];
+}
+
+// Matches text against a glob: '*' is any run of characters but '/', '**'
+// any run including '/', and "**/" also matches no directory at all.
+inline bool matchGlob(std::string_view pattern, std::string_view text)
+{
+    std::size_t p = 0;
+    std::size_t t = 0;
+    std::size_t starPattern = std::string_view::npos;
+    std::size_t starText = 0;
+    while (t < text.size())
+    {
+        if (p < pattern.size() && pattern[p] == '*')
+        {
+            if (p + 1 < pattern.size() && pattern[p + 1] == '*')
+            {
+                const std::size_t rest = p + 2;
+                if (rest < pattern.size() && pattern[rest] == '/' && matchGlob(pattern.substr(rest + 1), text.substr(t)))
+                    return true;
+                for (std::size_t from = t; from <= text.size(); from++)
+                {
+                    if (matchGlob(pattern.substr(rest), text.substr(from)))
+                        return true;
+                }
+            }
+            else
+            {
+                starPattern = ++p;
+                starText = t;
+                continue;
+            }
+        }
+        else
+        {
+            std::size_t used = 0;
+            if (p < pattern.size() && matchGlobItem(pattern.substr(p), text[t], used))
+            {
+                p += used;
+                t++;
+                continue;
+            }
+        }
+        // Let the last single '*' take one more character, never a '/'.
+        if (starPattern == std::string_view::npos || text[starText] == '/')
+            return false;
+        p = starPattern;
+        t = ++starText;
+    }
+    while (p < pattern.size() && pattern[p] == '*')
+        p++;
+    return p == pattern.size();
+}
+
+// One line of a .gitignore-style rule file.
+struct ignorePattern {
+    std::string glob;
+    // A leading '!': a matching entry is kept after all.
+    bool negated = false;
+    // A trailing '/': only directories match.
+    bool directoryOnly = false;
+    // A '/' before the end: the glob is matched against the path below the
+    // directory of the rules, not only against the name.
+    bool anchored = false;
+};
+
+// Reads one rule, returns false for blank lines and comments.
+inline bool parseIgnoreLine(std::string_view line, ignorePattern& pattern)
+{
+    if (!line.empty() && line.back() == '\r')
+        line.remove_suffix(1);
+    // Trailing spaces don't count unless escaped.
+    while (!line.empty() && line.back() == ' ' && !(line.size() > 1 && line[line.size() - 2] == '\\'))
+        line.remove_suffix(1);
+    if (line.empty() || line[0] == '#')
+        return false;
+
+    pattern = ignorePattern{};
+    if (line[0] == '!')
+    {
+        pattern.negated = true;
+        line.remove_prefix(1);
+    }
+    if (!line.empty() && line.back() == '/')
+    {
+        pattern.directoryOnly = true;
+        line.remove_suffix(1);
+    }
+    if (!line.empty() && line[0] == '/')
+    {
+        pattern.anchored = true;
+        line.remove_prefix(1);
+    }
+    if (line.empty())
+        return false;
+    pattern.anchored |= line.find('/') != std::string_view::npos;
+    pattern.glob = line;
+    return true;
+}
+
+// Appends the rules of a rule file. Returns false when it can't be read.
+inline bool loadIgnoreFile(const std::string& path, std::vector<ignorePattern>& patterns)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return false;
+    std::string line;
+    ignorePattern pattern;
+    while (std::getline(in, line))
+    {
+        if (parseIgnoreLine(line, pattern))
+            patterns.push_back(std::move(pattern));
+    }
+    return true;
+}
+
+// The part of path below base, which path starts with.
+inline std::string_view relativeTo(std::string_view base, std::string_view path)
+{
+    if (path.size() <= base.size())
+        return {};
+    std::size_t start = base.size();
+    if (!base.empty() && base.back() != '/' && base.back() != '\\')
+        start++;
+    return path.substr(start);
+}
+
+// The rules of one directory, for everything below it. Rules of the
+// directories above are reached through parent; a walk keeps one chain per
+// directory that brought rules of its own, the others share their parent's.
+struct ignoreRules {
+    const ignoreRules* parent = nullptr;
+    std::string base;
+    std::vector<ignorePattern> patterns;
+};
+
+// Like git: the last matching rule of the deepest directory decides.
+inline bool isIgnored(const ignoreRules* rules, std::string_view path, std::string_view name, bool directory)
+{
+    for (; rules != nullptr; rules = rules->parent)
+    {
+        if (rules->patterns.empty())
+            continue;
+        const std::string_view relative = relativeTo(rules->base, path);
+        for (auto pattern = rules->patterns.rbegin(); pattern != rules->patterns.rend(); ++pattern)
+        {
+            if (pattern->directoryOnly && !directory)
+                continue;
+            if (matchGlob(pattern->glob, pattern->anchored ? relative : name))
+                return !pattern->negated;
+        }
+    }
+    return false;
+}
+
+// Bytes looked at to tell binary files from text.
+constexpr std::size_t sniffSize = 4096;
+
+// A file is binary when its first sniffSize bytes hold a NUL byte, the test
+// git and grep use. Files that can't be read count as text, so the analysis
+// reports them.
+inline bool looksBinary(const char* path)
+{
+    char buffer[sniffSize];
+    std::size_t got = 0;
+    {
+        // The probe counts against the open files like any read.
+        const openFileSlot slot;
+        ASD_PROFILE_PHASE(profilePhase::open);
+#ifdef _WIN32
+        HANDLE file = CreateFileW(std::filesystem::path(path).c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+            nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+        DWORD read = 0;
+        if (ReadFile(file, buffer, static_cast<DWORD>(sniffSize), &read, nullptr))
+            got = read;
+        CloseHandle(file);
+#else
+        const int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+        const ssize_t read = ::read(fd, buffer, sniffSize);
+        if (read > 0)
+            got = static_cast<std::size_t>(read);
+        close(fd);
+#endif
+    }
+    return std::memchr(buffer, 0, got) != nullptr;
+}
+
+// What the walk skips. Everything is evaluated from the directory listing,
+// before a subdirectory is queued or a file is handed to the analysis, so a
+// pruned subtree is never listed and a skipped file never opened, except by
+// the binary sniff.
+struct scanFilter {
+    // Files must match one of these when there are any; globs with a '/'
+    // are matched against the path below the scanned root.
+    std::vector<std::string> includes;
+    // --exclude globs and the rules of --ignore-file, in the order given,
+    // applied below every scanned root.
+    std::vector<ignorePattern> excludes;
+    // Levels of subdirectories walked below a root, -1 for all.
+    int maxDepth = -1;
+    std::uint64_t minSize = 0;
+    std::uint64_t maxSize = std::numeric_limits<std::uint64_t>::max();
+    // Read a .gitignore in every walked directory.
+    bool gitignore = false;
+    bool skipBinary = false;
+
+    bool active() const
+    {
+        return !includes.empty() || !excludes.empty() || maxDepth >= 0 || minSize > 0
+            || maxSize != std::numeric_limits<std::uint64_t>::max() || gitignore || skipBinary;
+    }
+
+    bool limits_size() const
+    {
+        return minSize > 0 || maxSize != std::numeric_limits<std::uint64_t>::max();
+    }
+
+    // Whether the subdirectory at path, depth levels below its root, is walked.
+    bool keeps_directory(std::string_view path, std::string_view name, int depth, const ignoreRules* rules) const
+    {
+        if (maxDepth >= 0 && depth > maxDepth)
+            return false;
+        return !isIgnored(rules, path, name, true);
+    }
+
+    // Whether the file is counted. A size of unknownSize is looked up when
+    // the size limits need it and replaced with the real one.
+    bool keeps_file(const char* path, std::string_view name, std::uintmax_t& size, const ignoreRules* rules) const
+    {
+        if (!includes.empty())
+        {
+            const ignoreRules* root = rules;
+            while (root->parent != nullptr)
+                root = root->parent;
+            const std::string_view relative = relativeTo(root->base, path);
+            bool included = false;
+            for (const auto& glob : includes)
+            {
+                if (matchGlob(glob, glob.find('/') != std::string::npos ? relative : name))
+                {
+                    included = true;
+                    break;
+                }
+            }
+            if (!included)
+                return false;
+        }
+        if (isIgnored(rules, path, name, false))
+            return false;
+        if (limits_size())
+        {
+            if (size == unknownSize)
+            {
+                std::error_code error;
+                size = std::filesystem::file_size(path, error);
+                if (error)
+                    size = 0;
+            }
+            if (size < minSize || size > maxSize)
+                return false;
+        }
+        return !skipBinary || !looksBinary(path);
+    }
+};
@@ -0,0 +1,76 @@
+#pragma once
+#include <algorithm>
+#include <functional>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "Stats_Counter.hpp"
+
+// Hash accepting std::string_view, so looking up an existing group needs
+// no std::string.
+struct groupKeyHash {
+    using is_transparent = void;
+
+    std::size_t operator()(std::string_view key) const
+    {
+        return std::hash<std::string_view>{}(key);
+    }
+};
+
+using groupMap = std::unordered_map<std::string, counter, groupKeyHash, std::equal_to<>>;
+
+inline void addToGroup(groupMap& groups, std::string_view key, const counter& stats)
+{
+    auto found = groups.find(key);
+    if (found == groups.end())
+        found = groups.emplace(std::string(key), counter{}).first;
+    found->second += stats;
+}
+
+// Counts grouped by file extension and by top-level directory. Every
+// thread fills its own breakdown, they are merged once the scan is done.
+struct statsBreakdown {
+    groupMap byExtension;
+    groupMap byDirectory;
+
+    void add(std::string_view extension, std::string_view directory, const counter& stats)
+    {
+        addToGroup(byExtension, extension, stats);
+        addToGroup(byDirectory, directory, stats);
+    }
+
+    statsBreakdown& operator+=(const statsBreakdown& other)
+    {
+        for (const auto& [key, stats] : other.byExtension)
+            addToGroup(byExtension, key, stats);
+        for (const auto& [key, stats] : other.byDirectory)
+            addToGroup(byDirectory, key, stats);
+        return *this;
+    }
+};
+
+// Prints one group per line, the most non-empty lines first.
+inline void printGroups(std::ostream& out, const char* title, const groupMap& groups)
+{
+    std::vector<std::pair<std::string_view, counter>> sorted(groups.begin(), groups.end());
+    std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b)
+        { return a.second.nonEmptyLines != b.second.nonEmptyLines ? a.second.nonEmptyLines > b.second.nonEmptyLines : a.first < b.first; });
+
+    std::size_t width = std::string_view(title).size();
+    for (const auto& group : sorted)
+        width = std::max(width, group.first.size());
+
+    out << std::left << std::setw(static_cast<int>(width)) << title << std::right
+        << std::setw(10) << "files" << std::setw(16) << "non-empty lines" << std::setw(14) << "empty lines"
+        << std::setw(14) << "words" << std::setw(14) << "letters" << '\n';
+    for (const auto& [key, stats] : sorted)
+    {
+        out << std::left << std::setw(static_cast<int>(width)) << (key.empty() ? "(none)" : key) << std::right
+            << std::setw(10) << stats.howManyFiles << std::setw(16) << stats.nonEmptyLines << std::setw(14) << stats.emptyLines
+            << std::setw(14) << stats.numWords << std::setw(14) << stats.letters << '\n';
+    }
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <cstdint>
+#include <ostream>
+
+#include "Thread_Shards.hpp"
+
+// Structure necessary for statistical calculations.
+struct counter {
+    std::int64_t howManyDirectories = 0;
+    std::int64_t howManyFiles = 0;
+    std::int64_t emptyLines = 0;
+    std::int64_t nonEmptyLines = 0;
+    std::int64_t numWords = 0;
+    std::int64_t letters = 0;
+
+    counter& operator+=(const counter& other)
+    {
+        howManyDirectories += other.howManyDirectories;
+        howManyFiles += other.howManyFiles;
+        emptyLines += other.emptyLines;
+        nonEmptyLines += other.nonEmptyLines;
+        numWords += other.numWords;
+        letters += other.letters;
+        return *this;
+    }
+
+    counter& operator-=(const counter& other)
+    {
+        howManyDirectories -= other.howManyDirectories;
+        howManyFiles -= other.howManyFiles;
+        emptyLines -= other.emptyLines;
+        nonEmptyLines -= other.nonEmptyLines;
+        numWords -= other.numWords;
+        letters -= other.letters;
+        return *this;
+    }
+};
+
+using shardedCounter = threadShards<counter>;
+
+// Counts a run can be limited to, combined as bits of a metric set.
+// Metrics left out stay zero.
+constexpr unsigned metricLines = 1;
+constexpr unsigned metricWords = 2;
+constexpr unsigned metricLetters = 4;
+constexpr unsigned allMetrics = metricLines | metricWords | metricLetters;
+
+inline void printCounts(std::ostream& out, const counter& total, unsigned metrics = allMetrics)
+{
+    out << "Numbers of directories:     " << total.howManyDirectories << '\n';
+    out << "Numbers of Files:           " << total.howManyFiles << '\n';
+    if (metrics & metricLines)
+    {
+        out << "Numbers of non-empty Lines: " << total.nonEmptyLines << '\n';
+        out << "Numbers of Empty Lines:     " << total.emptyLines << '\n';
+    }
+    if (metrics & metricWords)
+        out << "Number of Words:            " << total.numWords << '\n';
+    if (metrics & metricLetters)
+        out << "Numbers of Letters:         " << total.letters << '\n';
+}
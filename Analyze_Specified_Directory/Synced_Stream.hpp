@@ -1,19 +1,106 @@
 #pragma once
+#include <condition_variable>
 #include <iostream>
 #include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Thread_Shards.hpp"
 
 using std::cout;
 
+// How printed items reach the output stream.
+enum class outputMode
+{
+    // Every print locks the stream and writes immediately.
+    direct,
+    // Every thread formats into its own buffer, full buffers are written
+    // in large chunks by a dedicated writer thread.
+    buffered,
+    // Nothing is written at all.
+    quiet
+};
+
+// Stream buffer appending everything written to it to a string.
+class appendStreambuf : public std::streambuf
+{
+public:
+
+    explicit appendStreambuf(std::string& _target)
+        : target(_target) {};
+
+protected:
+
+    int_type overflow(int_type c) override
+    {
+        if (!traits_type::eq_int_type(c, traits_type::eof()))
+            target.push_back(traits_type::to_char_type(c));
+        return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(const char* s, std::streamsize n) override
+    {
+        target.append(s, static_cast<std::size_t>(n));
+        return n;
+    }
+
+private:
+
+    std::string& target;
+};
+
 class syncedStream
 {
 public:
 
-    syncedStream(std::ostream& _out_stream = std::cout)
-        : out_stream(_out_stream) {};
+    syncedStream(std::ostream& _out_stream = std::cout, outputMode _mode = outputMode::direct)
+        : out_stream(_out_stream)
+    {
+        set_mode(_mode);
+    };
+
+    ~syncedStream()
+    {
+        set_mode(outputMode::direct);
+    }
+
+    // Switches the mode. Call only when no other thread is printing.
+    void set_mode(outputMode _mode)
+    {
+        if (mode == outputMode::buffered && _mode != outputMode::buffered)
+        {
+            flush();
+            {
+                const std::scoped_lock lock(chunks_mutex);
+                stopping = true;
+            }
+            chunks_ready.notify_one();
+            writer_thread.join();
+            stopping = false;
+        }
+        if (mode != outputMode::buffered && _mode == outputMode::buffered)
+        {
+            writer_thread = std::thread(&syncedStream::writer, this);
+        }
+        mode = _mode;
+    }
 
     template <typename... T>
     void print(const T &...items)
     {
+        if (mode == outputMode::quiet)
+            return;
+        if (mode == outputMode::buffered)
+        {
+            localBuffer& local = buffers.local();
+            const std::scoped_lock lock(local.buffer_mutex);
+            (local.out << ... << items);
+            if (local.text.size() >= chunk_size)
+                hand_over(local.text);
+            return;
+        }
         const std::scoped_lock lock(stream_mutex);
         (out_stream << ... << items);
     }
@@ -24,8 +111,90 @@ public:
         print(items..., '\n');
     }
 
+    // Writes out everything buffered so far and waits until it is written.
+    void flush()
+    {
+        if (mode == outputMode::buffered)
+        {
+            buffers.for_each([this](localBuffer& local)
+                {
+                    const std::scoped_lock lock(local.buffer_mutex);
+                    if (!local.text.empty())
+                        hand_over(local.text);
+                });
+            std::unique_lock lock(chunks_mutex);
+            chunks_written.wait(lock, [this] { return chunks.empty() && !writing; });
+        }
+        const std::scoped_lock lock(stream_mutex);
+        out_stream.flush();
+    }
+
 private:
 
+    // Text formatted by one thread and not handed to the writer yet.
+    struct localBuffer
+    {
+        std::mutex buffer_mutex = {};
+        std::string text;
+        appendStreambuf streambuf{ text };
+        std::ostream out{ &streambuf };
+    };
+
+    // Passes a full buffer to the writer thread and gives the caller an
+    // empty one back, reusing the memory of already written chunks.
+    void hand_over(std::string& text)
+    {
+        {
+            const std::scoped_lock lock(chunks_mutex);
+            chunks.push_back(std::move(text));
+            if (!spares.empty())
+            {
+                text = std::move(spares.back());
+                spares.pop_back();
+            }
+        }
+        text.clear();
+        chunks_ready.notify_one();
+    }
+
+    void writer()
+    {
+        std::vector<std::string> pending;
+        std::unique_lock lock(chunks_mutex);
+        while (true)
+        {
+            chunks_ready.wait(lock, [this] { return stopping || !chunks.empty(); });
+            if (chunks.empty())
+                break;
+            pending.swap(chunks);
+            writing = true;
+            lock.unlock();
+            {
+                const std::scoped_lock streamLock(stream_mutex);
+                for (const auto& chunk : pending)
+                    out_stream.write(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+            }
+            lock.lock();
+            for (auto& chunk : pending)
+                spares.push_back(std::move(chunk));
+            pending.clear();
+            writing = false;
+            chunks_written.notify_all();
+        }
+    }
+
+    static constexpr std::size_t chunk_size = 64 * 1024;
+
     mutable std::mutex stream_mutex = {};
     std::ostream& out_stream;
+    outputMode mode = outputMode::direct;
+    threadShards<localBuffer> buffers;
+    std::mutex chunks_mutex = {};
+    std::condition_variable chunks_ready = {};
+    std::condition_variable chunks_written = {};
+    std::vector<std::string> chunks = {};
+    std::vector<std::string> spares = {};
+    bool writing = false;
+    bool stopping = false;
+    std::thread writer_thread;
 };
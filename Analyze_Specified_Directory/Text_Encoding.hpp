@@ -0,0 +1,150 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <iterator>
+
+// How bytes are read as characters when counting words and letters. Lines
+// are the same in every encoding.
+enum class textEncoding
+{
+    // Letters are A-Z and a-z, white space is ' ', '\t', '\n', '\v', '\f'
+    // and '\r'; bytes from 0x80 up are neither.
+    ascii,
+    // ISO 8859-1: ASCII plus the accented letters, ª, µ, º, NEL and NBSP.
+    latin1,
+    // UTF-8: one character per code point, letters and white space as in
+    // Unicode. A byte that fits no sequence is one character of its own.
+    utf8
+};
+
+constexpr int textEncodings = 3;
+
+inline const char* encodingName(textEncoding encoding)
+{
+    static constexpr const char* names[textEncodings] = { "ascii", "latin1", "utf8" };
+    return names[static_cast<int>(encoding)];
+}
+
+// Class bits of a character; a character with neither is still part of a
+// word.
+constexpr std::uint8_t spaceClass = 1;
+constexpr std::uint8_t letterClass = 2;
+
+using byteClassTable = std::array<std::uint8_t, 256>;
+
+constexpr byteClassTable makeByteClasses(textEncoding encoding)
+{
+    byteClassTable classes{};
+    for (int c = 0; c < 256; c++)
+    {
+        if (c == ' ' || (c >= '\t' && c <= '\r'))
+            classes[c] = spaceClass;
+        else if ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z'))
+            classes[c] = letterClass;
+        else if (encoding != textEncoding::ascii && (c == 0x85 || c == 0xA0))
+            classes[c] = spaceClass;
+        else if (encoding != textEncoding::ascii && (c == 0xAA || c == 0xB5 || c == 0xBA || (c >= 0xC0 && c != 0xD7 && c != 0xF7)))
+            classes[c] = letterClass;
+    }
+    return classes;
+}
+
+// Classes of single bytes. Latin-1 is also the first 256 code points of
+// Unicode.
+inline constexpr byteClassTable asciiClasses = makeByteClasses(textEncoding::ascii);
+inline constexpr byteClassTable latin1Classes = makeByteClasses(textEncoding::latin1);
+
+template <textEncoding Encoding>
+constexpr const byteClassTable& byteClasses()
+{
+    if constexpr (Encoding == textEncoding::ascii)
+        return asciiClasses;
+    else
+        return latin1Classes;
+}
+
+struct codePointRange {
+    std::uint32_t first;
+    std::uint32_t last;
+};
+
+// Letters above U+00FF: the letter ranges of the scripts most text is
+// written in. Code points outside them, like combining marks, digits and
+// rarer scripts, are not letters.
+inline constexpr codePointRange letterRanges[] = {
+    { 0x0100, 0x02C1 }, { 0x02C6, 0x02D1 }, { 0x02E0, 0x02E4 }, { 0x0370, 0x0374 }, { 0x0376, 0x0377 },
+    { 0x037A, 0x037D }, { 0x037F, 0x037F }, { 0x0386, 0x0386 }, { 0x0388, 0x038A }, { 0x038C, 0x038C },
+    { 0x038E, 0x03A1 }, { 0x03A3, 0x03F5 }, { 0x03F7, 0x0481 }, { 0x048A, 0x052F }, { 0x0531, 0x0556 },
+    { 0x0559, 0x0559 }, { 0x0560, 0x0588 }, { 0x05D0, 0x05EA }, { 0x05EF, 0x05F2 }, { 0x0620, 0x064A },
+    { 0x066E, 0x066F }, { 0x0671, 0x06D3 }, { 0x06D5, 0x06D5 }, { 0x06E5, 0x06E6 }, { 0x06EE, 0x06EF },
+    { 0x06FA, 0x06FC }, { 0x06FF, 0x06FF }, { 0x0710, 0x0710 }, { 0x0712, 0x072F }, { 0x074D, 0x07A5 },
+    { 0x07B1, 0x07B1 }, { 0x0904, 0x0939 }, { 0x093D, 0x093D }, { 0x0950, 0x0950 }, { 0x0958, 0x0961 },
+    { 0x0971, 0x0980 }, { 0x0E01, 0x0E30 }, { 0x0E32, 0x0E33 }, { 0x0E40, 0x0E46 }, { 0x10A0, 0x10C5 },
+    { 0x10D0, 0x10FA }, { 0x10FC, 0x10FF }, { 0x1100, 0x11FF }, { 0x1E00, 0x1F15 }, { 0x1F18, 0x1F1D },
+    { 0x1F20, 0x1F45 }, { 0x1F48, 0x1F4D }, { 0x1F50, 0x1F57 }, { 0x1F59, 0x1F59 }, { 0x1F5B, 0x1F5B },
+    { 0x1F5D, 0x1F5D }, { 0x1F5F, 0x1F7D }, { 0x1F80, 0x1FB4 }, { 0x1FB6, 0x1FBC }, { 0x1FBE, 0x1FBE },
+    { 0x1FC2, 0x1FC4 }, { 0x1FC6, 0x1FCC }, { 0x1FD0, 0x1FD3 }, { 0x1FD6, 0x1FDB }, { 0x1FE0, 0x1FEC },
+    { 0x1FF2, 0x1FF4 }, { 0x1FF6, 0x1FFC }, { 0x2C00, 0x2CE4 }, { 0x2D00, 0x2D25 }, { 0x3041, 0x3096 },
+    { 0x309D, 0x309F }, { 0x30A1, 0x30FA }, { 0x30FC, 0x30FF }, { 0x3105, 0x312F }, { 0x3131, 0x318E },
+    { 0x3400, 0x4DBF }, { 0x4E00, 0x9FFF }, { 0xA000, 0xA48C }, { 0xA640, 0xA66E }, { 0xA680, 0xA69D },
+    { 0xA722, 0xA788 }, { 0xA78B, 0xA7CA }, { 0xAC00, 0xD7A3 }, { 0xF900, 0xFA6D }, { 0xFA70, 0xFAD9 },
+    { 0xFB00, 0xFB06 }, { 0xFB50, 0xFBB1 }, { 0xFBD3, 0xFD3D }, { 0xFE70, 0xFE74 }, { 0xFE76, 0xFEFC },
+    { 0xFF21, 0xFF3A }, { 0xFF41, 0xFF5A }, { 0xFF66, 0xFFBE }, { 0x10400, 0x1044F }, { 0x1D400, 0x1D7CB },
+    { 0x20000, 0x2A6DF }, { 0x2A700, 0x2EBE0 }, { 0x2F800, 0x2FA1D }, { 0x30000, 0x3134A }
+};
+
+// White space above U+00FF.
+inline constexpr std::uint32_t spaceCodePoints[] = {
+    0x1680, 0x2000, 0x2001, 0x2002, 0x2003, 0x2004, 0x2005, 0x2006, 0x2007, 0x2008, 0x2009, 0x200A,
+    0x2028, 0x2029, 0x202F, 0x205F, 0x3000
+};
+
+using planeClasses = std::array<std::uint64_t, 2048>;
+
+// The class bits of every code point of the Basic Multilingual Plane, two
+// bits each, so a character is classified with one load and no branch.
+inline const planeClasses bmpClasses = []
+{
+    planeClasses classes{};
+    auto set = [&](std::uint32_t c, std::uint8_t bits) { classes[c >> 5] |= std::uint64_t(bits) << ((c & 31) * 2); };
+    for (std::uint32_t c = 0; c < 0x100; c++)
+        set(c, latin1Classes[c]);
+    for (std::uint32_t c : spaceCodePoints)
+        set(c, spaceClass);
+    for (const auto& range : letterRanges)
+    {
+        for (std::uint32_t c = range.first; c <= std::min<std::uint32_t>(range.last, 0xFFFF); c++)
+            set(c, letterClass);
+    }
+    return classes;
+}();
+
+inline std::uint8_t codePointClass(std::uint32_t c)
+{
+    if (c < 0x10000)
+        return static_cast<std::uint8_t>((bmpClasses[c >> 5] >> ((c & 31) * 2)) & 3);
+    const auto found = std::upper_bound(std::begin(letterRanges), std::end(letterRanges), c,
+        [](std::uint32_t value, const codePointRange& range) { return value < range.first; });
+    return found != std::begin(letterRanges) && c <= std::prev(found)->last ? letterClass : 0;
+}
+
+// Continuation bytes that follow a UTF-8 lead byte, 0 for ASCII and -1 for
+// a byte no sequence starts with.
+inline int continuationBytes(unsigned char lead)
+{
+    if (lead < 0x80)
+        return 0;
+    if (lead < 0xC2)
+        return -1;
+    if (lead < 0xE0)
+        return 1;
+    if (lead < 0xF0)
+        return 2;
+    return lead < 0xF5 ? 3 : -1;
+}
+
+inline bool isContinuation(unsigned char c)
+{
+    return (c & 0xC0) == 0x80;
+}
@@ -1,37 +1,185 @@
 #pragma once
+#include <atomic>
+#include <condition_variable>
+#include <future>
 #include <thread>
+#include <memory>
 #include <mutex>
-#include <queue>
-#include <functional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "Cpu_Topology.hpp"
+#include "Phase_Profiler.hpp"
+#include "Pool_Task.hpp"
+
+// Scheduling strategy chosen at pool construction.
+enum class schedulerMode
+{
+	// Every task goes through one queue guarded by queue_mutex.
+	sharedQueue,
+	// Each worker owns a deque: it pops its own tasks LIFO and steals
+	// from the other workers FIFO. Tasks pushed from outside the pool
+	// land in the shared queue.
+	workStealing,
+	// Every task goes through a bounded lock-free ring. Tasks that don't
+	// fit into it wait in the shared queue.
+	lockFreeQueue
+};
+
+// How idle workers and wait_for_tasks() wait for something to happen.
+enum class waitMode
+{
+	// Sleep on a condition variable until a task is pushed or finished.
+	blocking,
+	// Poll with sleep_or_yield(), sleeping sleep_duration microseconds.
+	polling
+};
+
+// Where the workers run. Takes effect when the threads are (re)created.
+enum class placementMode
+{
+	// Wherever the system schedules them.
+	none,
+	// Every worker is pinned to one CPU, going through the CPUs in order.
+	pinned,
+	// Workers are spread over the NUMA nodes and may run on any CPU of
+	// their node. Tasks pushed from outside go to per-node queues in turn,
+	// and workers take and steal work from their own node first.
+	numa
+};
+
+// Tasks pushed with the same group can be waited for on their own,
+// without waiting for everything else in the pool.
+class taskGroup
+{
+	friend class threadPools;
+
+	// The last task decrements and notifies under the lock, and waiters
+	// check under it, so a waiter can't return and destroy the group while
+	// a finishing task still uses it.
+	mutable std::mutex group_mutex = {};
+	std::condition_variable group_done = {};
+	int pending = 0;
+
+	void add()
+	{
+		const std::scoped_lock lock(group_mutex);
+		pending++;
+	}
+
+	void finish()
+	{
+		const std::scoped_lock lock(group_mutex);
+		if (--pending == 0)
+			group_done.notify_all();
+	}
+
+	void wait()
+	{
+		std::unique_lock lock(group_mutex);
+		group_done.wait(lock, [this] { return pending == 0; });
+	}
+
+public:
+
+	bool done() const
+	{
+		const std::scoped_lock lock(group_mutex);
+		return pending == 0;
+	}
+};
 
 class threadPools
 {
-	bool paused = false;
+	// Local deque of one worker, used in the work-stealing mode.
+	struct workerQueue
+	{
+		std::mutex queue_mutex = {};
+		taskRing tasks = {};
+	};
+
+	std::atomic<bool> paused = false;
 	int sleep_duration = 1000;
 	mutable std::mutex queue_mutex = {};
-	bool running = true;
-	std::queue<std::function<void()>> tasks = {};
-	int thread_count;
+	std::atomic<bool> running = true;
+	taskRing tasks = {};
+	int thread_count = 0;
 	std::unique_ptr<std::thread[]> threads;
-	int tasks_total = 0;
+	std::atomic<int> tasks_total = 0;
+	schedulerMode mode = schedulerMode::sharedQueue;
+	std::unique_ptr<workerQueue[]> local_queues;
+	waitMode wait_mode = waitMode::blocking;
+	std::condition_variable task_available = {};
+	std::atomic<int> tasks_queued = 0;
+	std::atomic<int> idle_workers = 0;
+	std::mutex done_mutex = {};
+	std::condition_variable tasks_done = {};
+	placementMode placement = placementMode::none;
+	int node_count = 1;
+	std::vector<int> worker_nodes;
+	std::vector<std::vector<int>> worker_cpus;
+	std::vector<std::vector<int>> steal_orders;
+	std::unique_ptr<workerQueue[]> node_queues;
+	std::atomic<unsigned> next_node = 0;
+	std::unique_ptr<mpmcTaskRing> lock_free_tasks;
+	std::atomic<int> overflowed = 0;
+
+	static constexpr std::size_t lock_free_capacity = 4096;
+
+	// Identifies the pool and the worker slot of the calling thread.
+	inline static thread_local const threadPools* worker_owner = nullptr;
+	inline static thread_local int worker_index = -1;
 
 public:
 
-	threadPools(int _thread_count);
+	threadPools(int _thread_count, schedulerMode _mode = schedulerMode::sharedQueue, waitMode _wait_mode = waitMode::blocking);
 
 	~threadPools();
 
 	int get_tasks();
 
 
+	// Queues the task without allocating: it is stored inline in a
+	// poolTask, arguments are forwarded into it.
 	template <typename F>
-	void push_task(const F& task);
+	void push_task(F&& task);
 
 	template <typename F, typename... A>
-	void push_task(const F& task, const A &...args);
+	void push_task(F&& task, A&&... args);
+
+	// Queues the task and returns a future of its result. Unlike push_task
+	// this allocates the shared state of the future.
+	template <typename F, typename... A>
+	auto submit(F&& task, A&&... args) -> std::future<std::invoke_result_t<std::decay_t<F>&, std::decay_t<A>&...>>;
+
+	// Queues all tasks of the batch under one lock and clears it, keeping
+	// its capacity for the next batch.
+	void push_batch(std::vector<poolTask>& batch);
+
+	// Queues the task as a member of group.
+	template <typename F, typename... A>
+	void push_group_task(taskGroup& group, F&& task, A&&... args);
+
+	// Waits until every task of the group has finished. Called from a
+	// worker, it runs queued tasks in the meantime instead of blocking one
+	// of the pool's threads.
+	void wait_for_group(taskGroup& group);
 
 	void reset(int thread_count);
 
+	// Like reset(), but keeps the workers when their number doesn't change,
+	// so repeated runs don't add thread shards for new thread ids.
+	void resize(int thread_count);
+
+	// Changes the placement of the workers and recreates them.
+	void set_placement(placementMode _placement);
+
+	// Changes the scheduling strategy and recreates the workers.
+	void set_scheduler(schedulerMode _mode);
+
+	int get_thread_count() const;
+
 	void wait_for_tasks();
 
 
@@ -43,16 +191,37 @@ private:
 
 	void destroy_threads();
 
-	bool pop_task(std::function<void()>& task);
+	bool pop_task(poolTask& task);
+
+	bool pop_local_task(poolTask& task);
+
+	bool steal_task(poolTask& task);
+
+	bool pop_node_task(poolTask& task);
+
+	// The queue a task pushed from outside the workers goes to.
+	std::mutex& injection_mutex(taskRing*& queue);
+
+	void plan_placement();
+
+	// Queues a task pushed from outside the workers.
+	void push_shared(poolTask&& task);
 
 	void sleep_or_yield();
 
-	void worker();
+	void notify_task_pushed(int howMany = 1);
+
+	void notify_workers();
+
+	void finish_task();
+
+	void worker(int index);
 
 
 };
 
-threadPools::threadPools(int _threadPool)
+threadPools::threadPools(int _thread_count, schedulerMode _mode, waitMode _wait_mode)
+	: thread_count(std::max(1, _thread_count)), threads(new std::thread[thread_count]), mode(_mode), wait_mode(_wait_mode)
 {
 	create_threads();
 }
@@ -61,6 +230,7 @@ threadPools::~threadPools()
 {
 	wait_for_tasks();
 	running = false;
+	notify_workers();
 	destroy_threads();
 }
 
@@ -70,37 +240,119 @@ int threadPools::get_tasks()
 }
 
 template <typename F>
-void threadPools::push_task(const F& task)
+void threadPools::push_task(F&& task)
 {
 	tasks_total++;
+	if (mode == schedulerMode::workStealing && worker_owner == this)
 	{
-		const std::scoped_lock lock(queue_mutex);
-		tasks.push(std::function<void()>(task));
+		workerQueue& local = local_queues[worker_index];
+		{
+			const std::scoped_lock lock(local.queue_mutex);
+			local.tasks.push_back(poolTask(std::forward<F>(task)));
+		}
+		notify_task_pushed();
+		return;
 	}
+	push_shared(poolTask(std::forward<F>(task)));
+	notify_task_pushed();
 }
 template <typename F, typename... A>
-void threadPools::push_task(const F& task, const A &...args)
+void threadPools::push_task(F&& task, A&&... args)
 {
-	push_task([task, args...]
+	push_task([task = std::forward<F>(task), ... args = std::forward<A>(args)]() mutable
 		{ task(args...); });
 }
 
+template <typename F, typename... A>
+auto threadPools::submit(F&& task, A&&... args) -> std::future<std::invoke_result_t<std::decay_t<F>&, std::decay_t<A>&...>>
+{
+	using result = std::invoke_result_t<std::decay_t<F>&, std::decay_t<A>&...>;
+	std::packaged_task<result()> job([task = std::forward<F>(task), ... args = std::forward<A>(args)]() mutable
+		{ return task(args...); });
+	std::future<result> future = job.get_future();
+	push_task(std::move(job));
+	return future;
+}
+
+void threadPools::push_batch(std::vector<poolTask>& batch)
+{
+	if (batch.empty())
+		return;
+	const int howMany = static_cast<int>(batch.size());
+	tasks_total += howMany;
+	const bool local = mode == schedulerMode::workStealing && worker_owner == this;
+	if (mode == schedulerMode::lockFreeQueue)
+	{
+		for (auto& task : batch)
+			push_shared(std::move(task));
+	}
+	else
+	{
+		taskRing* queue = local ? &local_queues[worker_index].tasks : nullptr;
+		const std::scoped_lock lock(local ? local_queues[worker_index].queue_mutex : injection_mutex(queue));
+		for (auto& task : batch)
+			queue->push_back(std::move(task));
+	}
+	batch.clear();
+	notify_task_pushed(howMany);
+}
+
+template <typename F, typename... A>
+void threadPools::push_group_task(taskGroup& group, F&& task, A&&... args)
+{
+	group.add();
+	push_task([group = &group, task = std::forward<F>(task), ... args = std::forward<A>(args)]() mutable
+		{
+			task(args...);
+			group->finish();
+		});
+}
+
+void threadPools::wait_for_group(taskGroup& group)
+{
+	// Once no task is left to run, the remaining ones of the group are
+	// running on other threads and only need to be waited for.
+	poolTask task;
+	while (worker_owner == this && !group.done() && pop_task(task))
+	{
+		task();
+		task.reset();
+		finish_task();
+	}
+	group.wait();
+}
+
 void threadPools::reset(int threadCount)
 {
 	bool was_paused = paused;
 	paused = true;
 	wait_for_tasks();
 	running = false;
+	notify_workers();
 	destroy_threads();
-	thread_count = std::thread::hardware_concurrency();
+	thread_count = std::max(1, threadCount);
 	threads.reset(new std::thread[thread_count]);
 	paused = was_paused;
 	running = true;
 	create_threads();
 }
 
+void threadPools::resize(int threadCount)
+{
+	if (std::max(1, threadCount) == thread_count)
+		wait_for_tasks();
+	else
+		reset(threadCount);
+}
+
 void threadPools::wait_for_tasks()
 {
+	if (wait_mode == waitMode::blocking)
+	{
+		std::unique_lock lock(done_mutex);
+		tasks_done.wait(lock, [this] { return tasks_total == 0; });
+		return;
+	}
 	while (true)
 	{
 		if (!paused)
@@ -117,11 +369,105 @@ void threadPools::wait_for_tasks()
 	}
 }
 
+void threadPools::set_placement(placementMode _placement)
+{
+	placement = _placement;
+	reset(thread_count);
+}
+
+void threadPools::set_scheduler(schedulerMode _mode)
+{
+	bool was_paused = paused;
+	paused = true;
+	wait_for_tasks();
+	running = false;
+	notify_workers();
+	destroy_threads();
+	mode = _mode;
+	paused = was_paused;
+	running = true;
+	create_threads();
+}
+
+int threadPools::get_thread_count() const
+{
+	return thread_count;
+}
+
+// Decides node and CPUs of every worker, and the order in which a worker
+// visits the others when stealing: its own node first.
+void threadPools::plan_placement()
+{
+	const cpuTopology& topology = systemTopology();
+	node_count = placement == placementMode::numa ? static_cast<int>(topology.nodes.size()) : 1;
+	worker_nodes.assign(thread_count, 0);
+	worker_cpus.assign(thread_count, {});
+	if (placement == placementMode::pinned)
+	{
+		const std::vector<int> cpus = topology.all_cpus();
+		for (int i = 0; i < thread_count; i++)
+			worker_cpus[i] = { cpus[i % cpus.size()] };
+	}
+	else if (placement == placementMode::numa)
+	{
+		for (int i = 0; i < thread_count; i++)
+		{
+			worker_nodes[i] = i % node_count;
+			worker_cpus[i] = topology.nodes[worker_nodes[i]];
+		}
+	}
+
+	steal_orders.assign(thread_count, {});
+	for (int i = 0; i < thread_count; i++)
+	{
+		for (int pass = 0; pass < 2; pass++)
+		{
+			for (int j = 1; j < thread_count; j++)
+			{
+				const int victim = (i + j) % thread_count;
+				if ((worker_nodes[victim] == worker_nodes[i]) == (pass == 0))
+					steal_orders[i].push_back(victim);
+			}
+		}
+	}
+	node_queues.reset(node_count > 1 ? new workerQueue[node_count] : nullptr);
+}
+
+std::mutex& threadPools::injection_mutex(taskRing*& queue)
+{
+	if (node_count > 1)
+	{
+		workerQueue& node = node_queues[next_node++ % node_count];
+		queue = &node.tasks;
+		return node.queue_mutex;
+	}
+	queue = &tasks;
+	return queue_mutex;
+}
+
+void threadPools::push_shared(poolTask&& task)
+{
+	if (mode == schedulerMode::lockFreeQueue)
+	{
+		if (lock_free_tasks->try_push(task))
+			return;
+		overflowed++;
+	}
+	taskRing* queue = nullptr;
+	const std::scoped_lock lock(injection_mutex(queue));
+	queue->push_back(std::move(task));
+}
+
 void threadPools::create_threads()
 {
+	plan_placement();
+	if (mode == schedulerMode::lockFreeQueue && !lock_free_tasks)
+		lock_free_tasks = std::make_unique<mpmcTaskRing>(lock_free_capacity);
+	if (mode == schedulerMode::workStealing)
+		local_queues.reset(new workerQueue[thread_count]);
 	for (int i = 0; i < thread_count; i++)
 	{
-		threads[i] = std::thread(&threadPools::worker, this);
+		threads[i] = std::thread(&threadPools::worker, this, i);
 	}
 }
 
@@ -133,17 +479,83 @@ void threadPools::destroy_threads()
 	}
 }
 
-bool threadPools::pop_task(std::function<void()>& task)
+bool threadPools::pop_task(poolTask& task)
+{
+	if (mode == schedulerMode::workStealing && pop_local_task(task))
+		return true;
+	if (mode == schedulerMode::lockFreeQueue)
+	{
+		if (lock_free_tasks->try_pop(task))
+		{
+			tasks_queued--;
+			return true;
+		}
+		if (overflowed == 0)
+			return false;
+	}
+	bool found = node_count > 1 && pop_node_task(task);
+	if (!found)
+	{
+		const std::scoped_lock lock(queue_mutex);
+		if (!tasks.empty())
+		{
+			task = tasks.pop_front();
+			tasks_queued--;
+			found = true;
+		}
+	}
+	if (found && mode == schedulerMode::lockFreeQueue)
+		overflowed--;
+	return found || (mode == schedulerMode::workStealing && steal_task(task));
+}
+
+// Takes the most recently pushed task of the calling worker.
+bool threadPools::pop_local_task(poolTask& task)
 {
-	const std::scoped_lock lock(queue_mutex);
-	if (tasks.empty())
+	workerQueue& local = local_queues[worker_index];
+	const std::scoped_lock lock(local.queue_mutex);
+	if (local.tasks.empty())
 		return false;
-	else
+	task = local.tasks.pop_back();
+	tasks_queued--;
+	return true;
+}
+
+// Takes the oldest task pushed from outside to a node queue, trying the
+// worker's own node first.
+bool threadPools::pop_node_task(poolTask& task)
+{
+	for (int i = 0; i < node_count; i++)
 	{
-		task = std::move(tasks.front());
-		tasks.pop();
-		return true;
+		workerQueue& node = node_queues[(worker_nodes[worker_index] + i) % node_count];
+		const std::scoped_lock lock(node.queue_mutex);
+		if (!node.tasks.empty())
+		{
+			task = node.tasks.pop_front();
+			tasks_queued--;
+			return true;
+		}
 	}
+	return false;
+}
+
+// Takes the oldest task of another worker, visiting them round-robin,
+// those of the same node first.
+bool threadPools::steal_task(poolTask& task)
+{
+	for (int victimIndex : steal_orders[worker_index])
+	{
+		workerQueue& victim = local_queues[victimIndex];
+		const std::scoped_lock lock(victim.queue_mutex);
+		if (!victim.tasks.empty())
+		{
+			task = victim.tasks.pop_front();
+			tasks_queued--;
+			ASD_PROFILE_EVENT(profileEvent::tasksStolen, 1);
+			return true;
+		}
+	}
+	return false;
 }
 
 void threadPools::sleep_or_yield()
@@ -154,19 +566,71 @@ void threadPools::sleep_or_yield()
 		std::this_thread::yield();
 }
 
-void threadPools::worker()
+void threadPools::worker(int index)
 {
+	worker_owner = this;
+	worker_index = index;
+	pinCurrentThread(worker_cpus[index]);
 	while (running)
 	{
-		std::function<void()> task;
+		poolTask task;
 		if (!paused && pop_task(task))
 		{
 			task();
-			tasks_total--;
+			task.reset();
+			finish_task();
+			ASD_PROFILE_EVENT(profileEvent::tasksRun, 1);
 		}
-		else
+		else if (wait_mode == waitMode::polling)
 		{
+			ASD_PROFILE_PHASE(profilePhase::idle);
 			sleep_or_yield();
 		}
+		else
+		{
+			ASD_PROFILE_PHASE(profilePhase::idle);
+			std::unique_lock lock(queue_mutex);
+			idle_workers++;
+			task_available.wait(lock, [this] { return !running || (!paused && tasks_queued > 0); });
+			idle_workers--;
+		}
+	}
+}
+
+// Wakes sleeping workers for the pushed tasks, if any. The counter is bumped
+// before idle_workers is read, so a worker going to sleep either sees the
+// task or gets notified.
+void threadPools::notify_task_pushed(int howMany)
+{
+	tasks_queued += howMany;
+	if (wait_mode == waitMode::blocking && idle_workers > 0)
+	{
+		{
+			const std::scoped_lock lock(queue_mutex);
+		}
+		if (howMany == 1)
+			task_available.notify_one();
+		else
+			task_available.notify_all();
+	}
+}
+
+// Wakes every sleeping worker so it can re-check running and paused.
+void threadPools::notify_workers()
+{
+	{
+		const std::scoped_lock lock(queue_mutex);
+	}
+	task_available.notify_all();
+}
+
+void threadPools::finish_task()
+{
+	tasks_total--;
+	if (wait_mode == waitMode::blocking)
+	{
+		const std::scoped_lock lock(done_mutex);
+		if (tasks_total == 0)
+			tasks_done.notify_all();
 	}
 }
\ No newline at end of file
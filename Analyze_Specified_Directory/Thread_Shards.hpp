@@ -0,0 +1,104 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+// One accumulator per thread, padded to a full cache line so that
+// neighbouring shards never share one.
+template <typename T>
+struct alignas(64) threadShard {
+    std::thread::id owner;
+    T value;
+};
+
+// Value split into per-thread shards. Every thread only ever writes its
+// own shard, the shards are merged with += once the work is finished.
+template <typename T>
+class threadShards
+{
+public:
+
+    // Returns the shard of the calling thread, creating it on first use.
+    T& local();
+
+    // Sums all shards. Call only when no thread is writing anymore.
+    T merge() const;
+
+    // Drops all shards, so the next run starts from zero.
+    void clear();
+
+    // Calls visit on every shard. Call only when no thread is writing anymore.
+    template <typename F>
+    void for_each(F&& visit);
+
+private:
+
+    mutable std::mutex shards_mutex = {};
+    std::deque<threadShard<T>> shards = {};
+    std::atomic<std::uint64_t> generation = 0;
+};
+
+template <typename T>
+T& threadShards<T>::local()
+{
+    struct cachedShard {
+        const threadShards* owner = nullptr;
+        std::uint64_t generation = 0;
+        T* slot = nullptr;
+    };
+    thread_local cachedShard cached;
+
+    const std::uint64_t current = generation.load(std::memory_order_acquire);
+    if (cached.owner != this || cached.generation != current)
+    {
+        const std::scoped_lock lock(shards_mutex);
+        const std::thread::id self = std::this_thread::get_id();
+        T* slot = nullptr;
+        for (auto& shard : shards)
+        {
+            if (shard.owner == self)
+                slot = &shard.value;
+        }
+        if (slot == nullptr)
+        {
+            auto& shard = shards.emplace_back();
+            shard.owner = self;
+            slot = &shard.value;
+        }
+        cached = cachedShard{ this, current, slot };
+    }
+    return *cached.slot;
+}
+
+template <typename T>
+T threadShards<T>::merge() const
+{
+    const std::scoped_lock lock(shards_mutex);
+    T total{};
+    for (const auto& shard : shards)
+    {
+        total += shard.value;
+    }
+    return total;
+}
+
+template <typename T>
+void threadShards<T>::clear()
+{
+    const std::scoped_lock lock(shards_mutex);
+    shards.clear();
+    generation.fetch_add(1, std::memory_order_release);
+}
+
+template <typename T>
+template <typename F>
+void threadShards<T>::for_each(F&& visit)
+{
+    const std::scoped_lock lock(shards_mutex);
+    for (auto& shard : shards)
+    {
+        visit(shard.value);
+    }
+}
@@ -0,0 +1,223 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <system_error>
+
+#include "Dir_Enumerator.hpp"
+#include "Thread_Pool.hpp"
+
+// How the sizes of generated files are spread.
+enum class sizeDistribution
+{
+    // Every file has size bytes.
+    fixed,
+    // Sizes are uniform between size and maxSize bytes.
+    uniform,
+    // Sizes are log-normal around a median of size bytes, most files small
+    // and a few much larger, like in a real source tree.
+    lognormal
+};
+
+// Shape and content of a generated tree. The same spec always gives the
+// same tree, byte for byte, whatever the number of threads.
+struct treeSpec {
+    int depth = 3;
+    int fanout = 4;
+    int files = 16;
+    sizeDistribution distribution = sizeDistribution::lognormal;
+    std::uint64_t size = 4096;
+    std::uint64_t maxSize = 0;
+    int lineLength = 60;
+    int emptyPercent = 10;
+    std::uint64_t seed = 1;
+};
+
+struct treeTotals {
+    std::int64_t directories = 0;
+    std::int64_t files = 0;
+    std::int64_t bytes = 0;
+};
+
+inline std::uint64_t splitmix64(std::uint64_t& state)
+{
+    std::uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// Seed of child number index of the entry seeded with parent.
+inline std::uint64_t childSeed(std::uint64_t parent, std::uint64_t index)
+{
+    std::uint64_t state = parent ^ (index * 0xD1B54A32D192ED03ull);
+    return splitmix64(state);
+}
+
+// Uniform in [0, 1), from the top 53 bits.
+inline double unitInterval(std::uint64_t& state)
+{
+    return (splitmix64(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+inline std::uint64_t fileSizeOf(const treeSpec& spec, std::uint64_t& state)
+{
+    constexpr double maxGenerated = double(1ull << 40);
+    switch (spec.distribution)
+    {
+    case sizeDistribution::fixed:
+        return spec.size;
+    case sizeDistribution::uniform:
+        return spec.size + splitmix64(state) % (spec.maxSize - spec.size + 1);
+    default:
+    {
+        // Box-Muller by hand, std::normal_distribution differs between
+        // standard libraries.
+        const double u1 = 1.0 - unitInterval(state);
+        const double u2 = unitInterval(state);
+        const double normal = std::sqrt(-2.0 * std::log(u1)) * std::cos(6.283185307179586 * u2);
+        return static_cast<std::uint64_t>(std::min(maxGenerated, spec.size * std::exp(normal)));
+    }
+    }
+}
+
+// Writes size bytes of text: lines of words of ASCII letters separated by
+// spaces, around spec.lineLength bytes long, spec.emptyPercent of them
+// empty. A non-empty file always ends with a line break.
+inline bool writeText(const std::string& path, std::uint64_t size, const treeSpec& spec, std::uint64_t state)
+{
+    constexpr std::size_t chunkSize = 1 << 20;
+    thread_local std::string chunk;
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out)
+        return false;
+
+    std::uint64_t left = size;
+    while (left > 0)
+    {
+        chunk.clear();
+        while (chunk.size() < chunkSize && chunk.size() < left)
+        {
+            if (static_cast<int>(splitmix64(state) % 100) < spec.emptyPercent)
+            {
+                chunk += '\n';
+                continue;
+            }
+            const std::size_t length = 1 + splitmix64(state) % (2 * static_cast<std::uint64_t>(spec.lineLength));
+            const std::size_t end = chunk.size() + length;
+            while (chunk.size() < end)
+            {
+                std::uint64_t letters = splitmix64(state);
+                const int wordLength = 1 + static_cast<int>(letters % 9);
+                letters >>= 4;
+                for (int i = 0; i < wordLength; i++, letters >>= 5)
+                {
+                    const int letter = static_cast<int>(letters & 31);
+                    chunk += static_cast<char>(letter < 26 ? 'a' + letter : 'A' + letter - 26);
+                }
+                chunk += ' ';
+            }
+            chunk.back() = '\n';
+        }
+        if (chunk.size() > left)
+        {
+            chunk.resize(static_cast<std::size_t>(left));
+            chunk.back() = '\n';
+        }
+        out.write(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+        left -= chunk.size();
+    }
+    out.close();
+    return !out.fail();
+}
+
+// One generation in progress. Directory paths live in a deque, so tasks
+// only carry a pointer to theirs.
+struct treeGeneration {
+    const treeSpec& spec;
+    threadPools& pool;
+    std::mutex paths_mutex = {};
+    std::deque<std::string> paths = {};
+    std::atomic<std::int64_t> directories = 0;
+    std::atomic<std::int64_t> files = 0;
+    std::atomic<std::int64_t> bytes = 0;
+    std::atomic<std::int64_t> failures = 0;
+
+    const std::string* add_path(std::string path)
+    {
+        const std::scoped_lock lock(paths_mutex);
+        return &paths.emplace_back(std::move(path));
+    }
+};
+
+// Fills the directory with its files and queues its subdirectories.
+inline void generateDirectory(treeGeneration* generation, const std::string* path, std::uint64_t seed, int level)
+{
+    const treeSpec& spec = generation->spec;
+    for (int file = 0; file < spec.files; file++)
+    {
+        std::uint64_t state = childSeed(seed, 2 * static_cast<std::uint64_t>(file));
+        const std::uint64_t size = fileSizeOf(spec, state);
+        if (!writeText(joinPath(*path, ("file" + std::to_string(file) + ".txt").c_str()), size, spec, state))
+        {
+            generation->failures++;
+            continue;
+        }
+        generation->files++;
+        generation->bytes += static_cast<std::int64_t>(size);
+    }
+    if (level == spec.depth)
+        return;
+    for (int child = 0; child < spec.fanout; child++)
+    {
+        const std::string* childPath = generation->add_path(joinPath(*path, ("dir" + std::to_string(child)).c_str()));
+        std::error_code error;
+        if (!std::filesystem::create_directory(*childPath, error))
+        {
+            generation->failures++;
+            continue;
+        }
+        generation->directories++;
+        generation->pool.push_task([generation, childPath, seedOfChild = childSeed(seed, 2 * static_cast<std::uint64_t>(child) + 1), level]
+            { generateDirectory(generation, childPath, seedOfChild, level + 1); });
+    }
+}
+
+// Creates the tree described by spec below root, which must not exist yet
+// or be empty. The directories are filled in parallel by pool.
+inline bool generateTree(const std::string& root, const treeSpec& spec, threadPools& pool, treeTotals& totals, std::string& error)
+{
+    std::error_code status;
+    if (std::filesystem::exists(root, status) && !std::filesystem::is_empty(root, status))
+    {
+        error = "The directory " + root + " already exists and is not empty.";
+        return false;
+    }
+    std::filesystem::create_directories(root, status);
+    if (status)
+    {
+        error = "Could not create the directory " + root + ".";
+        return false;
+    }
+
+    treeGeneration generation{ spec, pool };
+    pool.push_task([&generation, path = generation.add_path(root), seed = spec.seed]
+        { generateDirectory(&generation, path, seed, 0); });
+    pool.wait_for_tasks();
+
+    totals.directories = generation.directories;
+    totals.files = generation.files;
+    totals.bytes = generation.bytes;
+    if (generation.failures > 0)
+    {
+        error = "Could not create " + std::to_string(generation.failures.load()) + " entries below " + root + ".";
+        return false;
+    }
+    return true;
+}
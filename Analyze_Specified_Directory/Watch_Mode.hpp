@@ -0,0 +1,230 @@
+#pragma once
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Byte_Counter.hpp"
+#include "Dir_Enumerator.hpp"
+#include "Dir_Watcher.hpp"
+#include "File_Reader.hpp"
+#include "Stats_Counter.hpp"
+
+// Counts of every file and the set of directories below the watched roots,
+// with the total kept up to date as single entries change.
+class liveTotals
+{
+public:
+
+    // Stores the counts of a new or changed file.
+    void set_file(const std::string& path, counter stats)
+    {
+        stats.howManyDirectories = 0;
+        stats.howManyFiles = 1;
+        const std::scoped_lock lock(totals_mutex);
+        auto [entry, inserted] = files.try_emplace(path, stats);
+        if (!inserted)
+        {
+            total -= entry->second;
+            entry->second = stats;
+        }
+        total += stats;
+    }
+
+    void add_directory(const std::string& path)
+    {
+        const std::scoped_lock lock(totals_mutex);
+        if (directories.insert(path).second)
+            total.howManyDirectories++;
+    }
+
+    bool has_directory(const std::string& path) const
+    {
+        const std::scoped_lock lock(totals_mutex);
+        return directories.count(path) != 0;
+    }
+
+    // Forgets a file, or a directory together with everything below it.
+    void remove(const std::string& path)
+    {
+        const std::scoped_lock lock(totals_mutex);
+        const auto file = files.find(path);
+        if (file != files.end())
+        {
+            total -= file->second;
+            files.erase(file);
+        }
+        if (directories.erase(path) != 0)
+            total.howManyDirectories--;
+
+        const std::string prefix = path + '/';
+        for (auto below = files.lower_bound(prefix); below != files.end() && below->first.compare(0, prefix.size(), prefix) == 0;)
+        {
+            total -= below->second;
+            below = files.erase(below);
+        }
+        for (auto below = directories.lower_bound(prefix); below != directories.end() && below->compare(0, prefix.size(), prefix) == 0;)
+        {
+            total.howManyDirectories--;
+            below = directories.erase(below);
+        }
+    }
+
+    void clear()
+    {
+        const std::scoped_lock lock(totals_mutex);
+        files.clear();
+        directories.clear();
+        total = counter{};
+    }
+
+    std::vector<std::string> directory_list() const
+    {
+        const std::scoped_lock lock(totals_mutex);
+        return std::vector<std::string>(directories.begin(), directories.end());
+    }
+
+    counter totals() const
+    {
+        const std::scoped_lock lock(totals_mutex);
+        return total;
+    }
+
+private:
+
+    mutable std::mutex totals_mutex;
+    std::map<std::string, counter> files;
+    std::set<std::string> directories;
+    counter total;
+};
+
+// Counts one file synchronously on the calling thread.
+inline bool countWholeFile(const std::string& path, counter& stats)
+{
+    scanState state;
+    counter counted;
+    if (!readFileBlocks(path.c_str(), [&](const char* data, std::size_t size) { countBytes(data, size, state, counted); }))
+        return false;
+    finishCount(state, counted);
+    stats = counted;
+    return true;
+}
+
+// Adds everything below directory to the totals and watches its subdirectories.
+inline void addTree(const std::string& directory, liveTotals& live, directoryWatcher& watcher)
+{
+    watcher.add_directory(directory);
+    std::vector<std::string> subdirectories;
+    enumerateDirectory(directory, [&](const directoryEntry& entry)
+        {
+            std::string path = joinPath(directory, entry.name);
+            counter stats;
+            if (entry.type == entryType::directory)
+                subdirectories.push_back(std::move(path));
+            else if (entry.type == entryType::file && countWholeFile(path, stats))
+                live.set_file(path, stats);
+        });
+    // Recursing only after the enumeration, which reuses one buffer per thread.
+    for (const auto& subdirectory : subdirectories)
+    {
+        live.add_directory(subdirectory);
+        addTree(subdirectory, live, watcher);
+    }
+}
+
+inline void applyChange(const pathChange& change, const std::vector<std::string>& roots, liveTotals& live, directoryWatcher& watcher)
+{
+    if (change.kind == changeKind::overflow)
+    {
+        live.clear();
+        for (const auto& root : roots)
+            addTree(root, live, watcher);
+        return;
+    }
+    if (change.kind == changeKind::removed)
+    {
+        live.remove(change.path);
+        return;
+    }
+
+    std::error_code error;
+    if (std::filesystem::is_directory(change.path, error))
+    {
+        // Changes inside a known directory are reported for its entries.
+        if (!live.has_directory(change.path))
+        {
+            live.add_directory(change.path);
+            addTree(change.path, live, watcher);
+        }
+        return;
+    }
+    counter stats;
+    if (std::filesystem::is_regular_file(change.path, error) && countWholeFile(change.path, stats))
+        live.set_file(change.path, stats);
+    else
+        live.remove(change.path);
+}
+
+// Writes the totals to path, replacing the previous ones atomically.
+inline void writeStatus(const std::string& path, const counter& total)
+{
+    const std::string temporary = path + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::trunc);
+        printCounts(out, total);
+        if (!out.flush())
+            return;
+    }
+    std::error_code error;
+    std::filesystem::rename(temporary, path, error);
+}
+
+// Keeps the totals up to date until "q" is entered. An empty line prints
+// the current totals; statusPath, if given, is rewritten after every batch
+// of changes so they can also be read without a terminal.
+inline void watchPaths(const std::vector<std::string>& roots, liveTotals& live, const std::string& statusPath)
+{
+    directoryWatcher watcher;
+    for (const auto& root : roots)
+    {
+        if (!watcher.add_root(root))
+            std::cout << "Could not watch " << root << std::endl;
+    }
+    // Directories found by the initial scan need their own watches on Linux.
+    for (const auto& directory : live.directory_list())
+        watcher.add_directory(directory);
+    if (!statusPath.empty())
+        writeStatus(statusPath, live.totals());
+
+    std::atomic<bool> stopping = false;
+    std::thread events([&]
+        {
+            while (!stopping)
+            {
+                const std::vector<pathChange> changes = watcher.wait_for_changes(250);
+                for (const auto& change : changes)
+                    applyChange(change, roots, live, watcher);
+                if (!changes.empty() && !statusPath.empty())
+                    writeStatus(statusPath, live.totals());
+            }
+        });
+
+    std::cout << std::endl << "Watching for changes. Press Enter for the current totals, type q to stop." << std::endl;
+    std::string line;
+    while (std::getline(std::cin, line) && line != "q" && line != "quit")
+    {
+        std::cout << std::endl;
+        printCounts(std::cout, live.totals());
+        std::cout << std::flush;
+    }
+    // Without a terminal the watch goes on until the process is stopped.
+    if (line == "q" || line == "quit")
+        stopping = true;
+    events.join();
+}
@@ -1,16 +1,21 @@
-#include <atomic>      
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cstdlib>
 #include <cstdint>
+#include <deque>
 #include <filesystem>
 #include <functional>
 #include <future>
 #include <fstream>
+#include <iomanip>
 #include <iostream> 
 #include <memory>
 #include <mutex>
 #include <queue>
+#include <semaphore>
 #include <string>
+#include <string_view>
 #include <thread>
 #include <type_traits>
 #include <utility>
@@ -18,64 +23,268 @@
 
 #include "Thread_Pool.hpp"
 #include "Synced_Stream.hpp"
+#include "Stats_Counter.hpp"
+#include "Stats_Breakdown.hpp"
+#include "Async_Reader.hpp"
+#include "Byte_Counter.hpp"
+#include "File_Reader.hpp"
+#include "File_Manifest.hpp"
+#include "Path_Arena.hpp"
+#include "Resource_Limits.hpp"
+#include "Dir_Enumerator.hpp"
+#include "Distributed_Scan.hpp"
+#include "Scan_Cache.hpp"
+#include "Scan_Filter.hpp"
+#include "Watch_Mode.hpp"
+#include "Command_Line.hpp"
+#include "Result_Output.hpp"
+#include "Tree_Generator.hpp"
+#include "Benchmark.hpp"
 
 using std::cout;
 using std::endl;
 
-#define _WIN32
-#define _linux_
-
-// Structure necessary for statistical calculations.
-struct counter {
-    int howManyDirectories;
-    int howManyFiles;
-    int emptyLines;
-    int nonEmptyLines;
-    int numWords;
-    int letters;
-};
-
 // Creating objects.
-threadPools pool(std::thread::hardware_concurrency());
+// The pool walks directories, analysis_pool counts the files it finds.
+threadPools pool(std::thread::hardware_concurrency(), schedulerMode::workStealing);
+threadPools analysis_pool(std::thread::hardware_concurrency(), schedulerMode::workStealing);
 syncedStream sync_out;
-counter count;
+shardedCounter count;
+threadShards<fileManifest> scanned;
+threadShards<pathArena> arenas;
+scanCache cache;
+
+// Limits the file jobs waiting for analysis_pool, so the walk can't run
+// ahead of the analysis by more than that.
+std::unique_ptr<std::counting_semaphore<>> fileSlots;
+
+// Files above splitThreshold bytes are counted in splitChunkSize pieces.
+std::size_t splitThreshold = 64ull << 20;
+std::size_t splitChunkSize = 8ull << 20;
+
+// With the asynchronous engine, files are counted in batches of
+// asyncBatchFiles, every analysis thread keeping ioDepth reads in flight.
+ioEngine readEngine = ioEngine::sync;
+int ioDepth = 32;
+constexpr std::size_t asyncBatchFiles = 64;
+
+// Files found by each discovery thread and not handed over yet, with the
+// bytes they count against inflightBytes.
+struct pendingBatch {
+    std::vector<const char*> paths;
+    std::uint64_t bytes = 0;
+};
+threadShards<pendingBatch> pendingFiles;
+
+// Directory tasks allowed in the discovery pool; beyond that a walk goes
+// on depth first on its own thread.
+int maxQueuedTasks = 16384;
+
+// Bytes of the files handed to analysis_pool and not counted yet, limited
+// with --max-inflight.
+resourceLimit inflightBytes;
+
+// What the walk skips. Without any filter the walk gets no rules at all
+// and checks nothing; with one, every root gets a rule set of its own, and
+// with --gitignore every directory with a .gitignore adds one kept by the
+// thread that walked it until the next walk.
+scanFilter filter;
+bool filtering = false;
+threadShards<std::deque<ignoreRules>> ruleSets;
+
+// Set for the tree jobs of a worker: once steady_clock passes walkDeadline,
+// subdirectories are no longer walked but put into unwalked, for the
+// coordinator to hand out again. Zero while there is no deadline.
+std::atomic<std::chrono::steady_clock::rep> walkDeadline = 0;
+threadShards<std::vector<std::string>> unwalked;
 
-// Function to calculate required counters such as number of words or letters
-void countStats(std::string path)
+const ignoreRules* rootRules(const std::string& root)
 {
-    std::ifstream inFile;
-    inFile.open(path);
-    if (inFile)
+    if (!filtering)
     {
-        std::string line;
+        return nullptr;
+    }
+    return &ruleSets.local().emplace_back(ignoreRules{ nullptr, root, filter.excludes });
+}
+
+// Extension the way std::filesystem::path::extension() sees it: from the
+// last dot on, unless the dot starts the name.
+std::string_view extensionOf(std::string_view name)
+{
+    const std::size_t dot = name.rfind('.');
+    if (dot == std::string_view::npos || dot == 0 || name == "..")
+        return {};
+    return name.substr(dot);
+}
+
+// The paths given on the command line; with --breakdown, counts are also
+// grouped by extension and by the directory directly below these.
+std::vector<std::string> scanRoots;
+bool breakdownEnabled = false;
+threadShards<statsBreakdown> breakdowns;
 
-        while (getline(inFile, line))
+// The path up to its directory directly below a scanned root, or the root
+// itself for files directly in it.
+std::string_view topLevelOf(std::string_view path)
+{
+    for (const auto& root : scanRoots)
+    {
+        if (root.empty() || path.size() <= root.size() || path.compare(0, root.size(), root) != 0)
+            continue;
+        std::size_t start = root.size();
+        if (root.back() != '/' && root.back() != '\\')
         {
-            if (line.empty())
-            {
-                count.emptyLines++;
-            }
-            if (line.size() > 0)
+            if (path[start] != '/' && path[start] != '\\')
+                continue;
+            start++;
+        }
+        const std::size_t end = path.find_first_of("/\\", start);
+        return end == std::string_view::npos ? std::string_view(root) : path.substr(0, end);
+    }
+    return {};
+}
+
+// Adds the counts of a file, or of one piece of it, to the thread's totals
+// and, with --breakdown, to the groups of its extension and top-level
+// directory. Only the first piece counts the file itself.
+void addCounts(std::string_view path, counter stats, bool firstPiece)
+{
+    count.local() += stats;
+    if (!breakdownEnabled)
+    {
+        return;
+    }
+    stats.howManyFiles = firstPiece ? 1 : 0;
+    const std::size_t slash = path.find_last_of("/\\");
+    const std::string_view name = slash == std::string_view::npos ? path : path.substr(slash + 1);
+    breakdowns.local().add(extensionOf(name), topLevelOf(path), stats);
+}
+
+// With --output, every counted file is also written as a record. Only the
+// authoritative pass records its files, benchmarked runs don't repeat them.
+std::unique_ptr<resultWriter> resultFile;
+bool recordingFiles = false;
+
+// Called once per file with the counts of all of it.
+void fileCounted(std::string_view path, const counter& stats)
+{
+    if (recordingFiles)
+    {
+        resultFile->write_file(path, stats);
+    }
+}
+
+// Receives the counts of a file once all of it has been counted.
+using fileCountedHandler = std::function<void(const counter&)>;
+
+// A mapped file being counted, possibly by several range tasks at once.
+struct countedFile {
+    countedFile(const char* _path, fileCountedHandler handler)
+        : file(_path), path(_path), onCounted(std::move(handler)) {};
+
+    // Range tasks of a split file may outlive the caller's path, so they
+    // get their own copy when the breakdown or the records need it.
+    void keep_path()
+    {
+        ownedPath = path;
+        path = ownedPath;
+    }
+
+    mappedFile file;
+    std::string_view path;
+    std::string ownedPath;
+    fileCountedHandler onCounted;
+    std::mutex total_mutex;
+    counter total;
+    std::size_t remaining = 1;
+};
+
+// Counts the byte range [begin, end) of a mapped file. Only the range
+// holding the end of the file accounts for its last line.
+void countRange(std::shared_ptr<countedFile> job, std::size_t begin, std::size_t end)
+{
+    const mappedFile& file = job->file;
+    counter stats;
+    scanState state = stateBefore(file.data(), begin);
+    countBytes(file.data() + begin, end - begin, state, stats);
+    if (end == file.size())
+    {
+        finishCount(state, stats);
+    }
+    addCounts(job->path, stats, begin == 0);
+
+    if (job->onCounted || recordingFiles)
+    {
+        bool finished = false;
+        {
+            const std::scoped_lock lock(job->total_mutex);
+            job->total += stats;
+            finished = --job->remaining == 0;
+        }
+        if (finished)
+        {
+            fileCounted(job->path, job->total);
+            if (job->onCounted)
             {
-                count.nonEmptyLines++;
+                job->onCounted(job->total);
             }
+        }
+    }
+}
 
-            for (const auto& elem : line)
+// Function to calculate required counters such as number of words or letters.
+// The file is scanned in one pass straight over its bytes, counts are gathered
+// locally and added to the thread's shard once per file. Files larger than
+// splitThreshold are split into ranges of splitChunkSize bytes which are
+// counted as separate pool tasks. onCounted, if given, gets the counts of
+// the whole file. With streamFileReads files are never mapped nor split.
+void countStats(const char* path, fileCountedHandler onCounted = {})
+{
+    if (!streamFileReads)
+    {
+        auto job = std::make_shared<countedFile>(path, std::move(onCounted));
+        const mappedFile& file = job->file;
+        if (file.is_mapped())
+        {
+            if (file.size() > splitThreshold)
             {
-                if ((elem >= 65 && elem <= 90) || (elem >= 97 && elem <= 122))
+                job->remaining = (file.size() + splitChunkSize - 1) / splitChunkSize;
+                if (breakdownEnabled || recordingFiles)
                 {
-                    count.letters++;
+                    job->keep_path();
                 }
+                taskGroup ranges;
+                for (std::size_t begin = 0; begin < file.size(); begin += splitChunkSize)
+                {
+                    analysis_pool.push_group_task(ranges, [job, begin, end = std::min(begin + splitChunkSize, file.size())]
+                        { countRange(job, begin, end); });
+                }
+                // The thread counts other tasks meanwhile. Returning only once
+                // the whole file is counted lets the caller give back its path
+                // and its bytes in flight.
+                analysis_pool.wait_for_group(ranges);
+                return;
             }
-            std::stringstream lineStream(line);
-            while (getline(lineStream, line, ' '))
-            {
-                count.numWords++;
-            }
-
+            countRange(job, 0, file.size());
+            return;
         }
+        onCounted = std::move(job->onCounted);
+    }
+
+    counter stats;
+    scanState state;
+    const bool opened = readStreamBlocks(path, [&](const char* data, std::size_t size)
+        { countBytes(data, size, state, stats); });
 
-        inFile.close();
+    if (opened)
+    {
+        finishCount(state, stats);
+        addCounts(path, stats, true);
+        fileCounted(path, stats);
+        if (onCounted)
+        {
+            onCounted(stats);
+        }
     }
     else
     {
@@ -83,96 +292,842 @@ void countStats(std::string path)
     }
 }
 
-// Function to create task in each directory entry on the path specified by the user
-void listFilesWithThreads(std::string path)
+// Counts the file, or takes its counts from the cache when it didn't
+// change since the previous run. Either way the result is cached again.
+void countIncremental(const char* path)
 {
-    try
+    fileIdentity identity;
+    if (!cache.enabled() || !statIdentity(path, identity))
+    {
+        countStats(path);
+        return;
+    }
+    counter stats;
+    if (cache.find_file(path, identity, stats))
+    {
+        addCounts(path, stats, true);
+        fileCounted(path, stats);
+        cache.record_file(path, identity, stats);
+        return;
+    }
+    countStats(path, [path, identity](const counter& counted)
+        { cache.record_file(path, identity, counted); });
+}
+
+// Counts a batch of files with the asynchronous reader of the calling
+// thread. Like countIncremental, unchanged files are taken from the cache
+// and everything counted is cached again.
+void countFileBatch(const std::vector<const char*>& paths)
+{
+    thread_local asyncReader reader(ioDepth);
+    thread_local std::vector<const char*> toRead;
+    thread_local std::vector<fileIdentity> identities;
+    thread_local std::vector<char> cacheable;
+    thread_local std::vector<countedResult> results;
+    toRead.clear();
+    identities.clear();
+    cacheable.clear();
+
+    for (const char* path : paths)
+    {
+        fileIdentity identity;
+        const bool known = cache.enabled() && statIdentity(path, identity);
+        counter stats;
+        if (known && cache.find_file(path, identity, stats))
+        {
+            addCounts(path, stats, true);
+            fileCounted(path, stats);
+            cache.record_file(path, identity, stats);
+            continue;
+        }
+        toRead.push_back(path);
+        identities.push_back(identity);
+        cacheable.push_back(known);
+    }
+
+    reader.count_files(toRead, results);
+    for (std::size_t i = 0; i < toRead.size(); i++)
+    {
+        if (!results[i].opened)
+        {
+            cout << "Wrong path given" << endl;
+            continue;
+        }
+        addCounts(toRead[i], results[i].stats, true);
+        fileCounted(toRead[i], results[i].stats);
+        if (cacheable[i])
+        {
+            cache.record_file(toRead[i], identities[i], results[i].stats);
+        }
+    }
+}
+
+template <void (*onFile)(const char* directory, const char* name, std::uintmax_t size)>
+void walkSubdirectory(const char* path, int depth, const ignoreRules* rules);
+
+// Function to create task in each directory entry on the path specified by the user.
+// Every regular file found is passed to onFile together with its directory
+// and its size, or unknownSize when the enumeration doesn't report sizes.
+// Paths of subdirectories are kept in the thread's arena until their walk is
+// done. depth is the level below the scanned root and rules the ignore rules
+// that apply in the directory, null when nothing is filtered; a .gitignore of
+// the directory replaces them with a chain of its own. While the pool holds
+// maxQueuedTasks tasks, subdirectories go to deferred instead.
+template <void (*onFile)(const char* directory, const char* name, std::uintmax_t size)>
+void listDirectory(const char* path, int depth, const ignoreRules*& rules, std::vector<const char*>& deferred)
+{
+    ASD_PROFILE_PHASE(profilePhase::walk);
+    ASD_PROFILE_EVENT(profileEvent::directoriesListed, 1);
+    if (filter.gitignore)
     {
-        for (auto& dirEntry : std::filesystem::directory_iterator(path))
+        std::vector<ignorePattern> patterns;
+        if (loadIgnoreFile(joinPath(path, ".gitignore"), patterns) && !patterns.empty())
+        {
+            rules = &ruleSets.local().emplace_back(ignoreRules{ rules, path, std::move(patterns) });
+        }
+    }
+    auto visit = [path, depth, rules, &deferred](const directoryEntry& entry)
+    {
+        if (entry.type == entryType::directory)
+        {
+            const char* directoryPath = arenas.local().join(path, entry.name);
+            if (rules != nullptr && !filter.keeps_directory(directoryPath, entry.name, depth + 1, rules))
+            {
+                pathArena::release(directoryPath);
+                return;
+            }
+            {
+                ASD_PROFILE_PHASE(profilePhase::listing);
+                sync_out.println("Directory: \"", directoryPath, '"');
+            }
+            count.local().howManyDirectories++;
+            if (pool.get_tasks() < maxQueuedTasks)
+            {
+                pool.push_task(walkSubdirectory<onFile>, directoryPath, depth + 1, rules);
+            }
+            else
+            {
+                deferred.push_back(directoryPath);
+            }
+        }
+        else if (entry.type == entryType::file)
         {
-            if (!dirEntry.is_regular_file())
+            std::uintmax_t size = entry.size;
+            if (rules != nullptr)
             {
-                sync_out.println("Directory: ", dirEntry.path());
-                count.howManyDirectories++;
+                thread_local std::string filePath;
+                filePath.assign(path);
+                if (!filePath.empty() && filePath.back() != '/' && filePath.back() != '\\')
+                {
+                    filePath += '/';
+                }
+                filePath += entry.name;
+                if (!filter.keeps_file(filePath.c_str(), entry.name, size, rules))
+                {
+                    return;
+                }
+            }
+            {
+                ASD_PROFILE_PHASE(profilePhase::listing);
+                sync_out.println("Filename: \"", entry.name, "\" extension: \"", extensionOf(entry.name), '"');
+            }
+            count.local().howManyFiles++;
+            onFile(path, entry.name, size);
+        }
+    };
 
-                std::string DirectoryName{ dirEntry.path().filename().string() };
-#ifdef _WIN32
-                pool.push_task(listFilesWithThreads, path + "/" + DirectoryName);
-                continue;
-#endif
-#ifdef _linux_
-                char sign = 92;
-                pool.push_task(listFilesWithThreads, path + sign + DirectoryName);
-                continue;
-#endif
+    // With the cache, a directory whose modification time didn't change
+    // still has the same entries, so they are taken from the cache.
+    fileIdentity directoryIdentity;
+    std::vector<cachedChild> children;
+    if (cache.enabled() && statIdentity(path, directoryIdentity))
+    {
+        if (cache.find_directory(path, directoryIdentity.mtime, children))
+        {
+            for (const auto& child : children)
+            {
+                visit(directoryEntry{ child.name.c_str(), child.type, unknownSize });
+            }
+        }
+        else
+        {
+            // Only a complete listing may stand for the directory later.
+            bool opened = false;
+            try
+            {
+                opened = enumerateDirectory(path, [&](const directoryEntry& entry)
+                    {
+                        children.push_back(cachedChild{ entry.name, entry.type });
+                        visit(entry);
+                    });
+            }
+            catch (...)
+            {
             }
-            if (dirEntry.is_regular_file())
+            if (!opened)
             {
-                std::filesystem::path file = dirEntry.path();
-                sync_out.println("Filename: ", file.filename(), " extension: ", file.extension());
-                count.howManyFiles++;
-                countStats(dirEntry.path().string());
+                cout << "Don't type path to system directories." << endl;
+                return;
             }
         }
+        cache.record_directory(path, directoryIdentity.mtime, std::move(children));
+        return;
+    }
+
+    bool opened = false;
+    try
+    {
+        opened = enumerateDirectory(path, visit);
     }
     catch (...)
+    {
+    }
+    if (!opened)
     {
         cout << "Don't type path to system directories." << endl;
     }
 
 }
 
-// The statistics are divided by the total number of all threads.
-// This is necessary for the correct calculations of the runtime execution.
-void summary(std::vector<double> elapsedWithThreads, int maxThreads)
+template <void (*onFile)(const char* directory, const char* name, std::uintmax_t size)>
+void walkDirectory(const char* path, int depth, const ignoreRules* rules)
+{
+    std::vector<const char*> deferred;
+    listDirectory<onFile>(path, depth, rules, deferred);
+    // The pool was full: the subdirectories are walked right here, depth
+    // first, so the queue stops growing and only the paths of one branch
+    // wait.
+    for (const char* subdirectory : deferred)
+    {
+        walkSubdirectory<onFile>(subdirectory, depth + 1, rules);
+    }
+}
+
+// Walks a subdirectory found by a walk and gives its path back.
+template <void (*onFile)(const char* directory, const char* name, std::uintmax_t size)>
+void walkSubdirectory(const char* path, int depth, const ignoreRules* rules)
+{
+    const auto deadline = walkDeadline.load(std::memory_order_relaxed);
+    if (deadline != 0 && std::chrono::steady_clock::now().time_since_epoch().count() > deadline)
+    {
+        unwalked.local().emplace_back(path);
+    }
+    else
+    {
+        walkDirectory<onFile>(path, depth, rules);
+    }
+    pathArena::release(path);
+}
+
+// Size of the file as counted against inflightBytes, 0 without a limit.
+std::uint64_t inflightSize(const char* path, std::uintmax_t size)
+{
+    if (!inflightBytes.limited())
+    {
+        return 0;
+    }
+    if (size == unknownSize)
+    {
+        std::error_code error;
+        size = std::filesystem::file_size(path, error);
+        if (error)
+            size = 0;
+    }
+    return size;
+}
+
+// Hands a batch of files over to analysis_pool and empties it.
+void submitBatch(pendingBatch& batch)
+{
+    {
+        ASD_PROFILE_PHASE(profilePhase::queueWait);
+        fileSlots->acquire();
+        inflightBytes.acquire(batch.bytes);
+    }
+    analysis_pool.push_task([paths = std::move(batch.paths), bytes = batch.bytes]
+        {
+            countFileBatch(paths);
+            for (const char* path : paths)
+            {
+                pathArena::release(path);
+            }
+            inflightBytes.release(bytes);
+            fileSlots->release();
+        });
+    batch.paths.clear();
+    batch.bytes = 0;
+}
+
+// Hands the file over to analysis_pool, waiting while the queue is full or
+// too many bytes are in flight. The asynchronous engine gets the files in
+// batches instead.
+void submitFile(const char* directory, const char* name, std::uintmax_t size)
+{
+    const char* path = arenas.local().join(directory, name);
+    const std::uint64_t bytes = inflightSize(path, size);
+    if (readEngine == ioEngine::async)
+    {
+        pendingBatch& batch = pendingFiles.local();
+        batch.paths.push_back(path);
+        batch.bytes += bytes;
+        if (batch.paths.size() == asyncBatchFiles)
+        {
+            submitBatch(batch);
+        }
+        return;
+    }
+    {
+        ASD_PROFILE_PHASE(profilePhase::queueWait);
+        fileSlots->acquire();
+        inflightBytes.acquire(bytes);
+    }
+    analysis_pool.push_task([path, bytes]
+        {
+            countIncremental(path);
+            pathArena::release(path);
+            inflightBytes.release(bytes);
+            fileSlots->release();
+        });
+}
+
+void recordFile(const char* directory, const char* name, std::uintmax_t size)
+{
+    if (size == unknownSize)
+    {
+        std::error_code error;
+        size = std::filesystem::file_size(joinPath(directory, name), error);
+        if (error)
+            size = 0;
+    }
+    scanned.local().add_file(directory, name, size);
+}
+
+// Walks the tree and queues every file found for analysis.
+void listFilesWithThreads(const std::string& root)
+{
+    walkDirectory<submitFile>(root.c_str(), 0, rootRules(root));
+}
+
+// Walks the tree and only records the files found, for later analysis.
+void collectFiles(const std::string& root)
+{
+    walkDirectory<recordFile>(root.c_str(), 0, rootRules(root));
+}
+
+void summary(const counter& total, const std::vector<benchmarkSeries>& series)
 {
     cout << endl << endl << "|| SUMMARY ||" << endl << endl;
-    cout << "Numbers of directories:     " << count.howManyDirectories / maxThreads << endl;
-    cout << "Numbers of Files:           " << count.howManyFiles / maxThreads << endl;
-    cout << "Numbers of non-empty Lines: " << count.nonEmptyLines / maxThreads << endl;
-    cout << "Numbers of Empty Lines:     " << count.emptyLines / maxThreads << endl;
-    cout << "Number of Words:            " << count.numWords / maxThreads << endl;
-    cout << "Numbers of Letters:         " << count.letters / maxThreads << endl;
+    printCounts(cout, total, countedMetrics);
+
+    if (breakdownEnabled)
+    {
+        const statsBreakdown groups = breakdowns.merge();
+        cout << endl << endl << "|| BREAKDOWN ||" << endl << endl;
+        printGroups(cout, "extension", groups.byExtension);
+        cout << endl;
+        printGroups(cout, "directory", groups.byDirectory);
+    }
 
     cout << endl << endl << "|| BENCHMARK ||" << endl << endl;
-    for (int i = 0; i < maxThreads; i++)
+    cout << "Counting kernel: " << selectedCountKernel().name << ", " << encodingName(countedEncoding) << endl << endl;
+    printBenchmark(series);
+}
+
+double secondsSince(std::chrono::steady_clock::time_point begin)
+{
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count() * 1e-9;
+}
+
+// Walks and counts all paths once as a two-stage pipeline: discovery
+// threads walk the tree and feed at most queueLimit waiting file jobs to
+// the analysis threads.
+counter scanPaths(const std::vector<std::string>& paths, int discoveryThreads, int analysisThreads, int queueLimit, double& elapsed)
+{
+    count.clear();
+    breakdowns.clear();
+    arenas.for_each([](pathArena& arena) { arena.clear(); });
+    pendingFiles.clear();
+    ruleSets.clear();
+    fileSlots = std::make_unique<std::counting_semaphore<>>(queueLimit);
+    pool.resize(discoveryThreads);
+    analysis_pool.resize(analysisThreads);
+    auto begin = std::chrono::steady_clock::now();
+    for (const auto& path : paths)
+    {
+        pool.push_task([&path] { listFilesWithThreads(path); });
+    }
+    pool.wait_for_tasks();
+    pendingFiles.for_each([](pendingBatch& batch)
+        {
+            if (!batch.paths.empty())
+            {
+                submitBatch(batch);
+            }
+        });
+    analysis_pool.wait_for_tasks();
+    elapsed = secondsSince(begin);
+    return count.merge();
+}
+
+// Walks all paths once and returns the files found, together with the
+// number of directories and files.
+fileManifest collectManifest(const std::vector<std::string>& paths, int howManyThreads, counter& found)
+{
+    count.clear();
+    scanned.clear();
+    ruleSets.clear();
+    arenas.for_each([](pathArena& arena) { arena.clear(); });
+    pool.reset(howManyThreads);
+    for (const auto& path : paths)
+    {
+        pool.push_task([&path] { collectFiles(path); });
+    }
+    pool.wait_for_tasks();
+    found = count.merge();
+    return scanned.merge();
+}
+
+// Counts all files of the manifest with freshly reset counters. Files are
+// handed out in batches, so small files don't cost one task each.
+counter analyzeManifest(const fileManifest& manifest, int howManyThreads, double& elapsed)
+{
+    constexpr std::size_t batchFiles = 64;
+    constexpr std::uintmax_t batchBytes = 4 << 20;
+
+    count.clear();
+    breakdowns.clear();
+    analysis_pool.reset(howManyThreads);
+    auto begin = std::chrono::steady_clock::now();
+    std::size_t first = 0;
+    std::uintmax_t bytes = 0;
+    std::vector<poolTask> batches;
+    for (std::size_t i = 0; i < manifest.size(); i++)
+    {
+        bytes += manifest.sizes[i];
+        if (i + 1 - first == batchFiles || bytes >= batchBytes || i + 1 == manifest.size())
+        {
+            batches.push_back([&manifest, first, last = i + 1]
+                {
+                    if (readEngine == ioEngine::async)
+                    {
+                        thread_local std::vector<std::string> paths;
+                        thread_local std::vector<const char*> batch;
+                        paths.resize(std::max(paths.size(), last - first));
+                        batch.clear();
+                        for (std::size_t file = first; file < last; file++)
+                        {
+                            manifest.path_of(file, paths[file - first]);
+                            batch.push_back(paths[file - first].c_str());
+                        }
+                        countFileBatch(batch);
+                        return;
+                    }
+                    // Reused for every file, split files only need it to open them.
+                    thread_local std::string path;
+                    for (std::size_t file = first; file < last; file++)
+                    {
+                        manifest.path_of(file, path);
+                        countStats(path.c_str());
+                    }
+                });
+            first = i + 1;
+            bytes = 0;
+        }
+    }
+    analysis_pool.push_batch(batches);
+    analysis_pool.wait_for_tasks();
+    elapsed = secondsSince(begin);
+    return count.merge();
+}
+
+// Counts the files directly in path and the subdirectories, whose names go
+// to subdirectories, for a level job of a distributed scan.
+counter countLevel(const std::string& path, int analysisThreads, std::vector<std::string>& subdirectories, bool& opened)
+{
+    count.clear();
+    analysis_pool.resize(analysisThreads);
+    std::vector<std::string> files;
+    opened = enumerateDirectory(path, [&](const directoryEntry& entry)
+        {
+            if (entry.type == entryType::directory)
+                subdirectories.push_back(entry.name);
+            else if (entry.type == entryType::file)
+                files.push_back(joinPath(path, entry.name));
+        });
+    for (const auto& file : files)
+    {
+        analysis_pool.push_task([&file] { countStats(file.c_str()); });
+    }
+    analysis_pool.wait_for_tasks();
+    counter found = count.merge();
+    found.howManyDirectories += static_cast<std::int64_t>(subdirectories.size());
+    found.howManyFiles += static_cast<std::int64_t>(files.size());
+    return found;
+}
+
+// Runs one job of a coordinator with the pools of this worker. Paths outside
+// the served roots are refused like directories that can't be listed.
+void serveJob(const scanRequest& request, scanResult& result, const options& settings, const std::vector<std::filesystem::path>& roots)
+{
+    if (!insideRoots(request.path, roots))
+    {
+        cout << "Refused a path outside the served ones: " << request.path << endl;
+        result.opened = false;
+        return;
+    }
+    countedMetrics = request.metrics;
+    countedEncoding = request.encoding;
+    if (request.kind == scanKind::level)
+    {
+        result.stats = countLevel(request.path, settings.threads, result.subdirectories, result.opened);
+    }
+    else
+    {
+        std::error_code error;
+        result.opened = std::filesystem::is_directory(request.path, error);
+        if (!result.opened)
+        {
+            return;
+        }
+        unwalked.clear();
+        if (request.sliceMilliseconds > 0)
+        {
+            const auto slice = std::chrono::milliseconds(request.sliceMilliseconds);
+            walkDeadline = (std::chrono::steady_clock::now() + slice).time_since_epoch().count();
+        }
+        double elapsed = 0;
+        result.stats = scanPaths({ request.path }, settings.discoveryThreads, settings.threads, settings.queueLimit, elapsed);
+        walkDeadline = 0;
+        // Sent below the job's path; they were counted as directories already.
+        unwalked.for_each([&](std::vector<std::string>& paths)
+            {
+                for (const auto& path : paths)
+                {
+                    result.subdirectories.emplace_back(relativeTo(request.path, path));
+                }
+            });
+    }
+
+    // The reply has to fit into one frame: the directories beyond
+    // maxReturnedBytes are walked here, without a deadline.
+    std::size_t returnedBytes = 0;
+    std::size_t fitting = 0;
+    while (fitting < result.subdirectories.size() && returnedBytes + result.subdirectories[fitting].size() + 10 <= maxReturnedBytes)
     {
-        if (i >= 9) cout << "Elapsed time listing with using " << i + 1 << " threads: " << std::setw(14) << std::fixed << elapsedWithThreads[i] << std::endl;
-        else if (i > 0) cout << "Elapsed time listing with using " << i + 1 << " threads: " << std::setw(15) << std::fixed << elapsedWithThreads[i] << std::endl;
-        else cout << "Elapsed time listing with using " << i + 1 << " thread: " << std::setw(16) << std::fixed << elapsedWithThreads[i] << std::endl;
+        returnedBytes += result.subdirectories[fitting++].size() + 10;
     }
+    if (fitting < result.subdirectories.size())
+    {
+        std::vector<std::string> rest;
+        for (std::size_t i = fitting; i < result.subdirectories.size(); i++)
+        {
+            rest.push_back(joinPath(request.path, result.subdirectories[i].c_str()));
+        }
+        result.subdirectories.resize(fitting);
+        double elapsed = 0;
+        result.stats += scanPaths(rest, settings.discoveryThreads, settings.threads, settings.queueLimit, elapsed);
+    }
+}
+
+// Scans the paths with the workers of --workers and prints what they found.
+int scanDistributed(const options& settings)
+{
+    scanCoordinator coordinator(settings.shardDepth, settings.metrics, settings.encoding);
+    std::vector<workerReport> reports;
+    counter total;
+    std::string error;
+    auto begin = std::chrono::steady_clock::now();
+    const bool scanned = coordinator.run(settings.paths, settings.workers, total, reports, error);
+    const double elapsed = secondsSince(begin);
+
+    cout << "|| WORKERS ||" << endl << endl;
+    printWorkers(cout, reports);
+    if (!scanned)
+    {
+        cout << endl << error << endl;
+        return 1;
+    }
+    if (!error.empty())
+    {
+        cout << endl << error << endl;
+    }
+    cout << endl << endl << "|| SUMMARY ||" << endl << endl;
+    printCounts(cout, total, countedMetrics);
+    cout << endl << "Scanned in " << elapsed << " s." << endl;
+    return 0;
 }
 
-int main()
+bool sameCounts(const counter& a, const counter& b)
 {
+    return a.emptyLines == b.emptyLines && a.nonEmptyLines == b.nonEmptyLines
+        && a.numWords == b.numWords && a.letters == b.letters;
+}
+
+int main(int argc, char* argv[])
+{
+    options settings;
+    std::string error;
+    if (!parseArguments(argc, argv, settings, error))
+    {
+        cout << error << endl << endl;
+        printUsage(argv[0]);
+        return 1;
+    }
+    if (settings.showHelp)
+    {
+        printUsage(argv[0]);
+        return 0;
+    }
+
     int maxThreads = std::thread::hardware_concurrency();
-    std::string path;
-    std::vector<double> elapsedWithThreads;
+    const bool interactive = settings.paths.empty() && settings.generatePath.empty() && settings.servePort.empty();
 
     cout << "|| ANALIZE SPECIFIED DIRECTORY ||" << endl << endl;
-    cout << "Don't type path to system directories." << endl;
-    cout << "Enter the path to be analyzed:" << endl;
-    std::cin >> path;
+    if (!settings.generatePath.empty())
+    {
+        treeTotals generated;
+        pool.reset(settings.discoveryThreads);
+        auto begin = std::chrono::steady_clock::now();
+        if (!generateTree(settings.generatePath, settings.tree, pool, generated, error))
+        {
+            cout << error << endl;
+            return 1;
+        }
+        cout << "Generated " << generated.directories << " directories and " << generated.files << " files of "
+            << generated.bytes << " bytes in " << secondsSince(begin) << " s." << endl << endl;
+        if (settings.paths.empty())
+        {
+            settings.paths.push_back(settings.generatePath);
+        }
+    }
 
-    while (!std::filesystem::exists(path))
+    if (interactive)
     {
-        cout << endl << "The path is incorrect! Try again:" << endl;
+        std::string path;
+        cout << "Don't type path to system directories." << endl;
+        cout << "Enter the path to be analyzed:" << endl;
         std::cin >> path;
+
+        while (!std::filesystem::exists(path))
+        {
+            cout << endl << "The path is incorrect! Try again:" << endl;
+            std::cin >> path;
+        }
+        settings.paths.push_back(path);
+        settings.benchmark = true;
+    }
+    // Paths of a distributed scan only have to exist on the workers.
+    for (const auto& path : settings.paths)
+    {
+        if (settings.workers.empty() && !std::filesystem::exists(path))
+        {
+            cout << "The path is incorrect: " << path << endl;
+            return 1;
+        }
     }
 
-    for (int howManyThreads = 1; howManyThreads <= maxThreads; howManyThreads++)
+    if (!settings.benchmark)
+    {
+        settings.threadList = { settings.threads };
+        settings.repetitions = 1;
+        settings.warmups = 0;
+    }
+    else if (settings.threadList.empty())
     {
-        pool.reset(howManyThreads);
-        auto begin = std::chrono::high_resolution_clock::now();
-        pool.push_task(listFilesWithThreads, path);
-        pool.wait_for_tasks();
-        auto end = std::chrono::high_resolution_clock::now();
-        double elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count() * 1e-9;
-        elapsedWithThreads.push_back(elapsed);
+        for (int howManyThreads = 1; howManyThreads <= maxThreads; howManyThreads++)
+        {
+            settings.threadList.push_back(howManyThreads);
+        }
     }
 
-    summary(elapsedWithThreads, maxThreads);
-    system("pause");
+    sync_out.set_mode(settings.listing);
+    if (settings.scheduler != schedulerMode::workStealing)
+    {
+        pool.set_scheduler(settings.scheduler);
+        analysis_pool.set_scheduler(settings.scheduler);
+    }
+    if (settings.placement != placementMode::none)
+    {
+        pool.set_placement(settings.placement);
+        analysis_pool.set_placement(settings.placement);
+    }
+    if (!settings.cachePath.empty())
+    {
+        if (settings.benchmark)
+        {
+            cout << "The cache is not used in benchmark mode." << endl;
+        }
+        else
+        {
+            cache.load(settings.cachePath);
+        }
+    }
+    // The watch starts from the per-file counts the cache records, and
+    // reads files that may be written while they are counted.
+    if (settings.watch)
+    {
+        cache.enable();
+        streamFileReads = true;
+    }
+    splitThreshold = settings.splitThreshold;
+    splitChunkSize = settings.splitChunkSize;
+    readEngine = settings.engine;
+    scanRoots = settings.paths;
+    breakdownEnabled = settings.breakdown;
+    countedMetrics = settings.metrics;
+    countedEncoding = settings.encoding;
+    filter = settings.filter;
+    maxQueuedTasks = settings.maxQueuedTasks;
+    if (settings.maxInflightBytes > 0)
+    {
+        inflightBytes.set_limit(settings.maxInflightBytes);
+    }
+    openFiles.set_limit(settings.maxOpenFiles > 0 ? settings.maxOpenFiles
+        : defaultOpenFileLimit(64 + 2 * static_cast<std::uint64_t>(settings.discoveryThreads + settings.threads)));
+    filtering = filter.active();
+    ioDepth = settings.ioDepth;
+    // A queue of that depth should work for every analysis thread when one
+    // does, so a scan asked to read asynchronously doesn't quietly read one
+    // file at a time instead.
+    if (readEngine == ioEngine::async)
+    {
+        ioQueue probe(ioDepth, 1);
+        if (!probe.ready())
+        {
+            cout << "Could not set up asynchronous reads with --io-depth " << ioDepth << ": " << probe.failure() << endl;
+            return 1;
+        }
+    }
+    // A worker doesn't list entries, its coordinator only gets the counts.
+    if (!settings.servePort.empty())
+    {
+        sync_out.set_mode(outputMode::quiet);
+        std::vector<std::filesystem::path> roots;
+        for (const auto& path : settings.paths)
+        {
+            roots.push_back(normalPath(path));
+        }
+        const auto run = [&settings, &roots](const scanRequest& request, scanResult& result) { serveJob(request, result, settings, roots); };
+        return serveScans(settings.bindAddress, settings.servePort, settings.threads, run, cout) ? 0 : 1;
+    }
+    if (!settings.workers.empty())
+    {
+        return scanDistributed(settings);
+    }
+    if (!settings.outputPath.empty())
+    {
+        resultFile = std::make_unique<resultWriter>(settings.outputPath, settings.outputFormat);
+        if (!resultFile->is_open())
+        {
+            cout << "Could not open the output file " << settings.outputPath << endl;
+            return 1;
+        }
+    }
+
+    if (settings.profile || !settings.tracePath.empty())
+    {
+#if ASD_PROFILING
+        if (!settings.tracePath.empty())
+        {
+            profiler().enable_trace();
+        }
+#else
+        cout << "Built without ASD_PROFILING, --profile and --trace are ignored." << endl;
+#endif
+    }
+
+    std::vector<benchmarkSeries> series;
+    counter total;
+    if (!settings.benchmark)
+    {
+        benchmarkSeries entry;
+        entry.threads = settings.threads;
+        double elapsed = 0;
+        recordingFiles = resultFile != nullptr;
+        total = scanPaths(settings.paths, settings.discoveryThreads, settings.threads, settings.queueLimit, elapsed);
+        if (!settings.cachePath.empty() && !cache.save(settings.cachePath))
+        {
+            cout << "Could not write the cache to " << settings.cachePath << endl;
+        }
+        recordingFiles = false;
+        entry.samples.push_back(elapsed);
+        series.push_back(entry);
+    }
+    else
+    {
+        const int widestRun = *std::max_element(settings.threadList.begin(), settings.threadList.end());
+        const fileManifest manifest = collectManifest(settings.paths, settings.discoveryThreads, total);
+
+        // The authoritative pass: every benchmarked run has to reproduce it.
+        double elapsed = 0;
+        recordingFiles = resultFile != nullptr;
+        total += analyzeManifest(manifest, widestRun, elapsed);
+        recordingFiles = false;
+        for (int warmup = 0; warmup < settings.warmups; warmup++)
+        {
+            analyzeManifest(manifest, settings.threadList.front(), elapsed);
+        }
+
+        for (int howManyThreads : settings.threadList)
+        {
+            benchmarkSeries entry;
+            entry.threads = howManyThreads;
+            for (int repetition = 0; repetition < settings.repetitions; repetition++)
+            {
+                if (settings.coldCache)
+                {
+                    dropFileCaches(settings.paths);
+                }
+                if (!sameCounts(analyzeManifest(manifest, howManyThreads, elapsed), total))
+                {
+                    cout << "Warning: the run with " << howManyThreads << " threads gave different counts, files changed during the benchmark." << endl;
+                }
+                entry.samples.push_back(elapsed);
+            }
+            series.push_back(entry);
+        }
+    }
+
+    sync_out.flush();
+    summary(total, series);
+#if ASD_PROFILING
+    if (settings.profile)
+    {
+        cout << endl << endl << "|| PROFILE ||" << endl << endl;
+        profiler().print(cout);
+    }
+    if (!settings.tracePath.empty() && !profiler().write_trace(settings.tracePath))
+    {
+        cout << "Could not write the trace to " << settings.tracePath << endl;
+    }
+#endif
+    if (resultFile)
+    {
+        resultFile->write_totals(total);
+        resultFile->write_benchmark(series);
+        if (!resultFile->close())
+        {
+            cout << "Could not write the results to " << settings.outputPath << endl;
+        }
+    }
+    if (settings.watch)
+    {
+        liveTotals live;
+        cache.for_each_file([&live](const std::string& path, const counter& stats)
+            { live.set_file(path, stats); });
+        cache.for_each_directory([&](const std::string& path)
+            {
+                if (std::find(settings.paths.begin(), settings.paths.end(), path) == settings.paths.end())
+                    live.add_directory(path);
+            });
+        sync_out.set_mode(outputMode::quiet);
+        watchPaths(settings.paths, live, settings.statusPath);
+    }
+    if (interactive)
+    {
+        system("pause");
+    }
 
     return 0;
 
@@ -0,0 +1,429 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../Analyze_Specified_Directory/Benchmark.hpp"
+#include "../Analyze_Specified_Directory/Byte_Counter.hpp"
+#include "../Analyze_Specified_Directory/Dir_Enumerator.hpp"
+#include "../Analyze_Specified_Directory/Thread_Pool.hpp"
+
+using std::cout;
+using std::endl;
+
+// Microbenchmarks of the hot paths on their own: the byte counting kernels,
+// the task queues of threadPools and the directory enumeration. Every case
+// runs once untimed and then `repetitions` times; the median is reported.
+
+int repetitions = 5;
+
+double secondsOf(const std::function<void()>& run)
+{
+    const auto begin = std::chrono::steady_clock::now();
+    run();
+    const auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count() * 1e-9;
+}
+
+double medianSeconds(const std::function<void()>& run)
+{
+    run();
+    std::vector<double> samples;
+    for (int repetition = 0; repetition < repetitions; repetition++)
+        samples.push_back(secondsOf(run));
+    return computeStats(samples).median;
+}
+
+// Text of about size bytes made of lines of lineLength bytes: words of five
+// letters separated by single spaces. A lineLength of 0 gives empty lines
+// only, a negative one lines of pseudo-random length up to -lineLength.
+std::string syntheticText(std::size_t size, int lineLength)
+{
+    std::string text;
+    text.reserve(size + 1024);
+    std::uint32_t seed = 12345;
+    while (text.size() < size)
+    {
+        int length = lineLength;
+        if (lineLength < 0)
+        {
+            seed = seed * 1664525 + 1013904223;
+            length = static_cast<int>((seed >> 8) % static_cast<std::uint32_t>(-lineLength + 1));
+        }
+        for (int i = 0; i < length; i++)
+            text += (i % 6 == 5) ? ' ' : static_cast<char>('a' + i % 26);
+        text += '\n';
+    }
+    return text;
+}
+
+// UTF-8 text of about size bytes: lines of up to 80 words of one to eight
+// characters, each character taken from letters.
+std::string syntheticUtf8(std::size_t size, const std::vector<std::string>& letters)
+{
+    std::string text;
+    text.reserve(size + 1024);
+    std::uint32_t seed = 12345;
+    while (text.size() < size)
+    {
+        seed = seed * 1664525 + 1013904223;
+        const int words = static_cast<int>((seed >> 8) % 12);
+        for (int word = 0; word < words; word++)
+        {
+            seed = seed * 1664525 + 1013904223;
+            for (std::uint32_t i = 0; i <= (seed >> 12) % 8; i++)
+                text += letters[((seed >> 4) + i * 7) % letters.size()];
+            text += word + 1 < words ? " " : "";
+        }
+        text += '\n';
+    }
+    return text;
+}
+
+std::vector<countKernelInfo> availableKernels()
+{
+    std::vector<countKernelInfo> kernels = { { ASD_KERNEL_TABLE(countBytesScalar), "scalar" } };
+#ifdef ASD_SIMD_X86
+    kernels.push_back({ ASD_KERNEL_TABLE(countBytesSSE2), "SSE2" });
+    if (cpuHasAVX2())
+        kernels.push_back({ ASD_KERNEL_TABLE(countBytesAVX2), "AVX2" });
+#elif defined(ASD_SIMD_NEON)
+    kernels.push_back({ ASD_KERNEL_TABLE(countBytesNEON), "NEON" });
+#endif
+    return kernels;
+}
+
+// Compares only the counts of the metric set.
+bool sameCounts(const counter& a, const counter& b, unsigned metrics = allMetrics)
+{
+    return (!(metrics & metricLines) || (a.emptyLines == b.emptyLines && a.nonEmptyLines == b.nonEmptyLines))
+        && (!(metrics & metricWords) || a.numWords == b.numWords)
+        && (!(metrics & metricLetters) || a.letters == b.letters);
+}
+
+counter countWith(countKernel kernel, const std::string& text)
+{
+    counter stats;
+    scanState state;
+    kernel(text.data(), text.size(), state, stats);
+    finishCount(state, stats);
+    return stats;
+}
+
+std::string metricsName(unsigned metrics)
+{
+    std::string name;
+    for (const auto& [bit, part] : { std::pair{ metricLines, "lines" }, { metricWords, "words" }, { metricLetters, "letters" } })
+    {
+        if (!(metrics & bit))
+            continue;
+        if (!name.empty())
+            name += ',';
+        name += part;
+    }
+    return name;
+}
+
+// Throughput of every kernel on 32 MiB of text per line length. Counts that
+// differ from the scalar kernel are reported as a mismatch.
+void benchmarkKernels()
+{
+    constexpr std::size_t textSize = 32 << 20;
+    const std::vector<countKernelInfo> kernels = availableKernels();
+
+    cout << "|| COUNTING KERNELS ||" << endl << endl;
+    cout << std::setw(14) << "line length";
+    for (const auto& kernel : kernels)
+        cout << std::setw(12) << kernel.name;
+    cout << "   [GB/s]" << endl;
+
+    for (int lineLength : { 0, 8, 80, 1000, -160 })
+    {
+        const std::string text = syntheticText(textSize, lineLength);
+        cout << std::setw(14) << (lineLength < 0 ? "random" : std::to_string(lineLength));
+        counter reference;
+        for (const auto& kernel : kernels)
+        {
+            counter stats;
+            const double seconds = medianSeconds([&] { stats = countWith(kernel.kernel(allMetrics, textEncoding::ascii), text); });
+            if (&kernel == &kernels.front())
+                reference = stats;
+            cout << std::fixed << std::setprecision(2) << std::setw(12) << text.size() / seconds * 1e-9;
+            if (!sameCounts(stats, reference))
+                cout << " MISMATCH";
+        }
+        cout << endl;
+    }
+    cout << endl;
+}
+
+// Throughput of every kernel for every metric set on 32 MiB of lines of
+// random length. Counts that differ from the full scalar count are reported
+// as a mismatch.
+void benchmarkMetricSets()
+{
+    constexpr std::size_t textSize = 32 << 20;
+    const std::vector<countKernelInfo> kernels = availableKernels();
+    const std::string text = syntheticText(textSize, -160);
+    const counter reference = countWith(countBytesScalar<allMetrics>, text);
+
+    cout << "|| METRIC SETS ||" << endl << endl;
+    cout << std::setw(20) << "metrics";
+    for (const auto& kernel : kernels)
+        cout << std::setw(12) << kernel.name;
+    cout << "   [GB/s]" << endl;
+
+    for (unsigned metrics = 1; metrics <= allMetrics; metrics++)
+    {
+        cout << std::setw(20) << metricsName(metrics);
+        for (const auto& kernel : kernels)
+        {
+            counter stats;
+            const double seconds = medianSeconds([&] { stats = countWith(kernel.kernel(metrics, textEncoding::ascii), text); });
+            cout << std::fixed << std::setprecision(2) << std::setw(12) << text.size() / seconds * 1e-9;
+            if (!sameCounts(stats, reference, metrics))
+                cout << " MISMATCH";
+        }
+        cout << endl;
+    }
+    cout << endl;
+}
+
+// Throughput of every kernel in every encoding, on ASCII text, on Polish
+// text with a few letters outside ASCII and on Chinese text. Counts that
+// differ from the scalar kernel of the same encoding are reported as a
+// mismatch.
+void benchmarkEncodings()
+{
+    constexpr std::size_t textSize = 32 << 20;
+    const std::vector<countKernelInfo> kernels = availableKernels();
+    const std::pair<const char*, std::string> texts[] = {
+        { "ascii text", syntheticText(textSize, -160) },
+        { "polish text", syntheticUtf8(textSize, { "a", "\xC4\x85", "c", "\xC4\x87", "e", "\xC4\x99", "l", "\xC5\x82", "n", "o",
+            "\xC3\xB3", "r", "s", "\xC5\x9B", "t", "w", "y", "z", "\xC5\xBC", "i", "k", "m", "p", "d" }) },
+        { "chinese text", syntheticUtf8(textSize, { "\xE7\x9A\x84", "\xE4\xB8\x80", "\xE6\x98\xAF", "\xE4\xB8\x8D", "\xE4\xBA\x86",
+            "\xE4\xBA\xBA", "\xE6\x88\x91", "\xE5\x9C\xA8", "\xE6\x9C\x89", "\xE4\xBB\x96" }) }
+    };
+
+    cout << "|| ENCODINGS ||" << endl << endl;
+    cout << std::setw(22) << "encoding, text";
+    for (const auto& kernel : kernels)
+        cout << std::setw(12) << kernel.name;
+    cout << "   [GB/s]" << endl;
+
+    for (textEncoding encoding : { textEncoding::ascii, textEncoding::latin1, textEncoding::utf8 })
+    {
+        for (const auto& [name, text] : texts)
+        {
+            cout << std::setw(22) << std::string(encodingName(encoding)) + ", " + name;
+            counter reference;
+            for (const auto& kernel : kernels)
+            {
+                counter stats;
+                const double seconds = medianSeconds([&] { stats = countWith(kernel.kernel(allMetrics, encoding), text); });
+                if (&kernel == &kernels.front())
+                    reference = stats;
+                cout << std::fixed << std::setprecision(2) << std::setw(12) << text.size() / seconds * 1e-9;
+                if (!sameCounts(stats, reference))
+                    cout << " MISMATCH";
+            }
+            cout << endl;
+        }
+    }
+    cout << endl;
+}
+
+const char* schedulerName(schedulerMode mode)
+{
+    switch (mode)
+    {
+    case schedulerMode::sharedQueue:
+        return "shared";
+    case schedulerMode::workStealing:
+        return "stealing";
+    default:
+        return "lockfree";
+    }
+}
+
+// Tasks per second of every scheduler: pushed one by one from several
+// outside threads at once, pushed as batches, and spawned from inside the
+// pool as a tree, which is where the work-stealing deques are used.
+void benchmarkPool()
+{
+    constexpr int tasksPerProducer = 100000;
+    constexpr int treeDepth = 16;
+    const int workers = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    const int producers = std::max(2, workers / 2);
+
+    cout << "|| THREAD POOL ||" << endl << endl;
+    cout << workers << " workers, " << producers << " pushing threads" << endl;
+    cout << std::setw(12) << "scheduler" << std::setw(14) << "push_task" << std::setw(14) << "push_batch"
+        << std::setw(14) << "spawned" << "   [M tasks/s]" << endl;
+
+    for (schedulerMode mode : { schedulerMode::sharedQueue, schedulerMode::workStealing, schedulerMode::lockFreeQueue })
+    {
+        threadPools pool(workers, mode);
+        std::atomic<std::int64_t> done = 0;
+
+        const double pushed = medianSeconds([&]
+            {
+                std::vector<std::thread> threads;
+                for (int producer = 0; producer < producers; producer++)
+                {
+                    threads.emplace_back([&]
+                        {
+                            for (int i = 0; i < tasksPerProducer; i++)
+                                pool.push_task([&done] { done.fetch_add(1, std::memory_order_relaxed); });
+                        });
+                }
+                for (auto& thread : threads)
+                    thread.join();
+                pool.wait_for_tasks();
+            });
+
+        const double batched = medianSeconds([&]
+            {
+                std::vector<std::thread> threads;
+                for (int producer = 0; producer < producers; producer++)
+                {
+                    threads.emplace_back([&]
+                        {
+                            std::vector<poolTask> batch;
+                            for (int i = 0; i < tasksPerProducer; i++)
+                            {
+                                batch.push_back([&done] { done.fetch_add(1, std::memory_order_relaxed); });
+                                if (batch.size() == 64)
+                                    pool.push_batch(batch);
+                            }
+                            pool.push_batch(batch);
+                        });
+                }
+                for (auto& thread : threads)
+                    thread.join();
+                pool.wait_for_tasks();
+            });
+
+        std::function<void(int)> spawn = [&](int depth)
+        {
+            done.fetch_add(1, std::memory_order_relaxed);
+            if (depth == 0)
+                return;
+            pool.push_task([&spawn, depth] { spawn(depth - 1); });
+            pool.push_task([&spawn, depth] { spawn(depth - 1); });
+        };
+        const double spawned = medianSeconds([&]
+            {
+                pool.push_task([&spawn] { spawn(treeDepth); });
+                pool.wait_for_tasks();
+            });
+
+        const double pushedTasks = static_cast<double>(producers) * tasksPerProducer;
+        const double treeTasks = static_cast<double>((1 << (treeDepth + 1)) - 1);
+        cout << std::setw(12) << schedulerName(mode) << std::fixed << std::setprecision(2)
+            << std::setw(14) << pushedTasks / pushed * 1e-6 << std::setw(14) << pushedTasks / batched * 1e-6
+            << std::setw(14) << treeTasks / spawned * 1e-6 << endl;
+    }
+    cout << endl;
+}
+
+// Counts the entries below path with enumerateDirectory, one directory
+// after the other on the calling thread.
+std::size_t enumerateTree(const std::string& path)
+{
+    std::size_t entries = 0;
+    std::vector<std::string> directories = { path };
+    while (!directories.empty())
+    {
+        const std::string directory = std::move(directories.back());
+        directories.pop_back();
+        enumerateDirectory(directory, [&](const directoryEntry& entry)
+            {
+                entries++;
+                if (entry.type == entryType::directory)
+                    directories.push_back(joinPath(directory, entry.name));
+            });
+    }
+    return entries;
+}
+
+// Entries per second of enumerateDirectory and of
+// std::filesystem::recursive_directory_iterator on a generated tree.
+void benchmarkEnumeration()
+{
+    constexpr int directories = 64;
+    constexpr int filesPerDirectory = 256;
+
+    const std::filesystem::path root = std::filesystem::temp_directory_path() / "asd_microbenchmark_tree";
+    std::filesystem::remove_all(root);
+    for (int d = 0; d < directories; d++)
+    {
+        const std::filesystem::path directory = root / ("dir" + std::to_string(d));
+        std::filesystem::create_directories(directory);
+        for (int f = 0; f < filesPerDirectory; f++)
+            std::ofstream(directory / ("file" + std::to_string(f) + ".txt")) << "x\n";
+    }
+
+    std::size_t enumerated = 0;
+    const double native = medianSeconds([&] { enumerated = enumerateTree(root.string()); });
+    std::size_t iterated = 0;
+    const double iterator = medianSeconds([&]
+        {
+            iterated = 0;
+            for (const auto& entry : std::filesystem::recursive_directory_iterator(root))
+            {
+                iterated++;
+                (void)entry.is_regular_file();
+            }
+        });
+    std::filesystem::remove_all(root);
+
+    cout << "|| DIRECTORY ENUMERATION ||" << endl << endl;
+    cout << directories << " directories of " << filesPerDirectory << " files" << endl;
+    cout << std::fixed << std::setprecision(2)
+        << std::setw(32) << "enumerateDirectory" << std::setw(12) << enumerated / native * 1e-6 << " M entries/s" << endl
+        << std::setw(32) << "recursive_directory_iterator" << std::setw(12) << iterated / iterator * 1e-6 << " M entries/s" << endl;
+    if (enumerated != iterated)
+        cout << "MISMATCH: " << enumerated << " entries enumerated, " << iterated << " iterated" << endl;
+    cout << endl;
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<std::string> groups;
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string argument = argv[i];
+        if ((argument == "-r" || argument == "--repeat") && i + 1 < argc)
+            repetitions = std::max(1, std::atoi(argv[++i]));
+        else if (argument == "kernels" || argument == "metrics" || argument == "encodings" || argument == "pool" || argument == "enumerate")
+            groups.push_back(argument);
+        else
+        {
+            cout << "Usage: " << argv[0] << " [-r <repetitions>] [kernels] [metrics] [encodings] [pool] [enumerate]" << endl;
+            return argument == "-h" || argument == "--help" ? 0 : 1;
+        }
+    }
+    auto selected = [&](const char* group) { return groups.empty() || std::find(groups.begin(), groups.end(), group) != groups.end(); };
+
+    if (selected("kernels"))
+        benchmarkKernels();
+    if (selected("metrics"))
+        benchmarkMetricSets();
+    if (selected("encodings"))
+        benchmarkEncodings();
+    if (selected("pool"))
+        benchmarkPool();
+    if (selected("enumerate"))
+        benchmarkEnumeration();
+    return 0;
+}